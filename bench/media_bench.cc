@@ -0,0 +1,300 @@
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include "media_element.h"
+#include "media_process.h"
+
+// microbenchmarks of the framework, results in json so runs can be compared.
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchResult {
+	std::string name;
+	std::string params;
+	uint64_t ops;
+	double seconds;
+};
+
+static std::vector<BenchResult> results;
+
+static void report(const std::string &name, const std::string &params, uint64_t ops, Clock::time_point begin) {
+	double seconds = std::chrono::duration_cast<std::chrono::duration<double> >(Clock::now() - begin).count();
+	results.push_back({name, params, ops, seconds});
+	std::cerr << name << " " << params << ": " << (seconds * 1e9 / ops) << " ns/op" << std::endl;
+}
+
+// workers are threads of the stage, producers are threads feeding it.
+static std::string countParam(const std::string &key, size_t count) {
+	return "{\"" + key + "\":" + std::to_string(count) + "}";
+}
+
+// metadata is boost text archive serialized, set and get cost dominate small stages.
+static void benchMetadata(uint64_t n) {
+	BaseMediaElement me;
+	Clock::time_point begin = Clock::now();
+	for (uint64_t i = 0; i < n; ++i) {
+		me.setMetadata<size_t>("count", i);
+	}
+	report("metadata_set", "{}", n, begin);
+
+	begin = Clock::now();
+	for (uint64_t i = 0; i < n; ++i) {
+		size_t value = me.getMetadata<size_t>("count");
+		// keep the read without a store to memory.
+		asm volatile("" : : "r"(value));
+	}
+	report("metadata_get", "{}", n, begin);
+}
+
+static void benchBuffer(uint64_t n, size_t size) {
+	std::string params = "{\"size\":" + std::to_string(size) + "}";
+	Clock::time_point begin = Clock::now();
+	for (uint64_t i = 0; i < n; ++i) {
+		std::shared_ptr<BaseMediaBuffer> buffer = std::make_shared<BaseMediaBuffer>(size);
+		buffer->data()[0] = 1;
+	}
+	report("buffer_alloc_free", params, n, begin);
+
+	std::shared_ptr<BaseMediaBufferPool> pool = std::make_shared<BaseMediaBufferPool>(size);
+	begin = Clock::now();
+	for (uint64_t i = 0; i < n; ++i) {
+		std::shared_ptr<BaseMediaBuffer> buffer = pool->acquire();
+		buffer->data()[0] = 1;
+	}
+	report("buffer_pool_acquire_release", params, n, begin);
+}
+
+class BenchPipe: public BaseMediaProcessPipe {
+public:
+	virtual const size_t getInputCount() const {
+		return 1;
+	}
+
+	virtual const size_t getOutputCount() const {
+		return 1;
+	}
+
+	virtual void input(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
+		outputHandlers_[0](mediaElement);
+	}
+};
+
+class BenchThreadedPipe: public BaseMediaProcessThreadedPipe {
+public:
+	explicit BenchThreadedPipe(uint8_t count): BaseMediaProcessThreadedPipe(count) {}
+
+	virtual void process(const std::shared_ptr<BaseMediaElement> &mediaElement) {
+	}
+};
+
+class BenchSink: public BaseMediaProcessCollapsar {
+public:
+	BenchSink(std::atomic<uint64_t> &count): count_(count) {}
+
+	virtual const size_t getInputCount() const {
+		return 1;
+	}
+
+	virtual const size_t getOutputCount() const {
+		return 0;
+	}
+
+	virtual void input(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
+		++count_;
+	}
+
+private:
+	std::atomic<uint64_t> &count_;
+};
+
+// made before the timed region, so hops do not include allocation.
+static std::vector<std::shared_ptr<BaseMediaElement> > makeElements(uint64_t n) {
+	std::vector<std::shared_ptr<BaseMediaElement> > elements(n);
+	for (auto &me : elements) {
+		me = std::make_shared<BaseMediaElement>();
+	}
+	return elements;
+}
+
+// feed elements from producers threads, wait till all come out.
+static void feed(const std::function<void(std::shared_ptr<BaseMediaElement>)> &input,
+		const std::vector<std::shared_ptr<BaseMediaElement> > &elements, size_t producers, std::atomic<uint64_t> &out) {
+	uint64_t n = elements.size();
+	std::vector<std::thread> threads;
+	for (size_t p = 0; p < producers; ++p) {
+		threads.emplace_back([&, p]() {
+			for (uint64_t i = p; i < n; i += producers) {
+				input(elements[i]);
+			}
+		});
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+	while (out.load() < n) {
+		std::this_thread::yield();
+	}
+}
+
+// composed, so hop includes stats recorded by init wiring.
+static void benchPipe(uint64_t n, size_t producers) {
+	std::atomic<uint64_t> out(0);
+	BaseMediaProcessPipe pipe(std::make_shared<BenchPipe>());
+	pipe.setOutputHandler(0, [&out](std::shared_ptr<BaseMediaElement> me) {
+		++out;
+	});
+	std::vector<std::shared_ptr<BaseMediaElement> > elements = makeElements(n);
+
+	Clock::time_point begin = Clock::now();
+	feed([&pipe](std::shared_ptr<BaseMediaElement> me) {
+		pipe.input(0, me);
+	}, elements, producers, out);
+	report("hop_pipe", countParam("producers", producers), n, begin);
+}
+
+static void benchThreadedPipe(uint64_t n, size_t workers) {
+	std::atomic<uint64_t> out(0);
+	BenchThreadedPipe pipe(static_cast<uint8_t>(workers));
+	pipe.setOutputHandler(0, [&out](std::shared_ptr<BaseMediaElement> me) {
+		++out;
+	});
+	pipe.start();
+	std::vector<std::shared_ptr<BaseMediaElement> > elements = makeElements(n);
+
+	Clock::time_point begin = Clock::now();
+	feed([&pipe](std::shared_ptr<BaseMediaElement> me) {
+		pipe.input(0, me);
+	}, elements, 1, out);
+	report("hop_threaded_pipe", countParam("workers", workers), n, begin);
+	pipe.stop();
+	pipe.wait();
+}
+
+static void benchCachePipe(uint64_t n, size_t producers) {
+	std::atomic<uint64_t> out(0);
+	BaseMediaProcessCachePipe pipe(64, 256);
+	pipe.setOutputHandler(0, [&out](std::shared_ptr<BaseMediaElement> me) {
+		++out;
+	});
+	pipe.start();
+	std::vector<std::shared_ptr<BaseMediaElement> > elements = makeElements(n);
+
+	Clock::time_point begin = Clock::now();
+	feed([&pipe](std::shared_ptr<BaseMediaElement> me) {
+		pipe.input(0, me);
+	}, elements, producers, out);
+	report("hop_cache_pipe", countParam("producers", producers), n, begin);
+	pipe.stop();
+	pipe.wait();
+}
+
+// synthetic 1080p yuv420 frames from a pool.
+class BenchFrameGenerator: public BaseMediaProcessGenerator {
+public:
+	BenchFrameGenerator(uint64_t count): count_(count),
+		pool_(std::make_shared<BaseMediaBufferPool>(1920 * 1080 * 3 / 2)) {}
+
+	virtual const size_t getInputCount() const {
+		return 0;
+	}
+
+	virtual const size_t getOutputCount() const {
+		return 1;
+	}
+
+	virtual bool generate() {
+		if (count_ == 0) {
+			return false;
+		}
+		--count_;
+		auto me = std::make_shared<BaseMediaElement>();
+		me->setMediaBuffer("frame", pool_->acquire());
+		outputHandlers_[0](me);
+		return true;
+	}
+
+private:
+	uint64_t count_;
+	std::shared_ptr<BaseMediaBufferPool> pool_;
+};
+
+static void benchEndToEnd(uint64_t n, size_t workers) {
+	std::atomic<uint64_t> out(0);
+	auto pipe = std::make_shared<BenchThreadedPipe>(static_cast<uint8_t>(workers));
+	BaseMediaProcessRunloop runloop(std::make_shared<BenchFrameGenerator>(n), pipe, std::make_shared<BenchSink>(out));
+	pipe->start();
+
+	Clock::time_point begin = Clock::now();
+	runloop.run();
+	while (out.load() < n) {
+		std::this_thread::yield();
+	}
+	report("end_to_end_1080p", countParam("workers", workers), n, begin);
+	pipe->stop();
+	pipe->wait();
+}
+
+static void writeJson(std::ostream &os) {
+	os << "{\"results\":[" << std::endl;
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchResult &r = results[i];
+		os << "  {\"name\":\"" << r.name << "\",\"params\":" << r.params
+		   << ",\"ops\":" << r.ops << ",\"seconds\":" << r.seconds
+		   << ",\"ns_per_op\":" << (r.seconds * 1e9 / r.ops)
+		   << ",\"ops_per_second\":" << (r.ops / r.seconds) << "}"
+		   << (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+	os << "]}" << std::endl;
+}
+
+// usage: mp_bench [result-json-path] [iterations]
+int main(int argc, char const *argv[]) {
+	uint64_t n = 100000;
+	if (argc > 2) {
+		n = std::stoull(argv[2]);
+	}
+	// 1080p runs take a tenth of them, each run needs at least one.
+	if (n < 10) {
+		std::cerr << "iterations " << n << " too few, expect at least 10." << std::endl;
+		return 1;
+	}
+	const size_t threadCounts[] = {1, 2, 4, 8, 16};
+	// hops are measured as mpserver runs them with metrics exported, and once without stats below.
+	MediaStageStats::enabled() = true;
+
+	benchMetadata(n);
+	benchBuffer(n, 4096);
+	benchBuffer(n / 10, 1920 * 1080 * 3 / 2);
+
+	for (auto producers : threadCounts) {
+		benchPipe(n, producers);
+	}
+	MediaStageStats::enabled() = false;
+	benchPipe(n, 1);
+	results.back().name = "hop_pipe_no_stats";
+	MediaStageStats::enabled() = true;
+
+	for (auto workers : threadCounts) {
+		benchThreadedPipe(n, workers);
+	}
+	for (auto producers : threadCounts) {
+		benchCachePipe(n, producers);
+	}
+	for (auto workers : threadCounts) {
+		benchEndToEnd(n / 10, workers);
+	}
+
+	if (argc > 1) {
+		std::ofstream out(argv[1]);
+		writeJson(out);
+	} else {
+		writeJson(std::cout);
+	}
+	return 0;
+}
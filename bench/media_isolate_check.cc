@@ -0,0 +1,179 @@
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include "media_element.h"
+#include "media_process.h"
+#include "media_config.h"
+#include "media_isolate.h"
+
+// check of isolated stages made from pipeline config: an element goes through the child and back
+// whole, and finish returns in time with a child that hangs and no longer reads. exits 1 on the
+// first failure.
+
+using Clock = std::chrono::steady_clock;
+
+static bool fail(const std::string &what) {
+	std::cerr << "mp_isolate_check: " << what << std::endl;
+	return false;
+}
+
+// wait up to 5 s for done.
+static bool waitFor(const std::function<bool()> &done) {
+	Clock::time_point end = Clock::now() + std::chrono::seconds(5);
+	while (!done()) {
+		if (Clock::now() >= end) {
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+class CheckIdentity: public BaseMediaProcessPipe {
+public:
+	virtual const size_t getInputCount() const {
+		return 1;
+	}
+
+	virtual const size_t getOutputCount() const {
+		return 1;
+	}
+
+	virtual void input(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
+		outputHandlers_[0](mediaElement);
+	}
+};
+
+// third-party code that never returns.
+class CheckHang: public BaseMediaProcessPipe {
+public:
+	virtual const size_t getInputCount() const {
+		return 1;
+	}
+
+	virtual const size_t getOutputCount() const {
+		return 1;
+	}
+
+	virtual void input(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
+		while (true) {
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+		}
+	}
+};
+
+static std::shared_ptr<BaseMediaProcess> isolated(const std::string &type) {
+	boost::property_tree::ptree tree;
+	std::istringstream is("{\"type\": \"isolated\", \"stage\": {\"type\": \"" + type + "\"}}");
+	boost::property_tree::read_json(is, tree);
+	return MediaPipelineConfig::createStage(MediaStageParams(tree));
+}
+
+static bool checkElement() {
+	std::shared_ptr<BaseMediaProcess> mp = isolated("CheckIdentity");
+	std::mutex mutex;
+	std::vector<std::shared_ptr<BaseMediaElement> > out;
+	mp->setOutputHandler(0, [&](std::shared_ptr<BaseMediaElement> me) {
+		std::unique_lock<std::mutex> lock(mutex);
+		out.emplace_back(me);
+	});
+
+	auto me = std::make_shared<BaseMediaElement>();
+	me->setMetadata<size_t>("index", 42);
+	// one buffer crosses as a memfd, one is copied into one.
+	std::shared_ptr<BaseMediaBuffer> shared = MediaIsolatedPipe::acquire(4096);
+	auto copied = std::make_shared<BaseMediaBuffer>(1000);
+	for (size_t i = 0; i < shared->size(); ++i) {
+		shared->data()[i] = static_cast<uint8_t>(i);
+	}
+	for (size_t i = 0; i < copied->size(); ++i) {
+		copied->data()[i] = static_cast<uint8_t>(i * 3);
+	}
+	me->setMediaBuffer("shared", shared);
+	me->setMediaBuffer("copied", copied);
+	mp->input(0, me);
+
+	if (!waitFor([&]() { std::unique_lock<std::mutex> lock(mutex); return !out.empty(); })) {
+		return fail("element did not come back from the isolated stage.");
+	}
+	std::shared_ptr<BaseMediaElement> back = out.front();
+	if (back->getMetadata<size_t>("index") != 42) {
+		return fail("metadata differs after the isolated stage.");
+	}
+	std::shared_ptr<BaseMediaBuffer> a = back->getMediaBuffer("shared");
+	std::shared_ptr<BaseMediaBuffer> b = back->getMediaBuffer("copied");
+	if (!a || a->size() != shared->size() || !b || b->size() != copied->size()) {
+		return fail("buffers differ in size after the isolated stage.");
+	}
+	for (size_t i = 0; i < a->size(); ++i) {
+		if (a->data()[i] != static_cast<uint8_t>(i)) {
+			return fail("shared buffer data differs after the isolated stage.");
+		}
+	}
+	for (size_t i = 0; i < b->size(); ++i) {
+		if (b->data()[i] != static_cast<uint8_t>(i * 3)) {
+			return fail("copied buffer data differs after the isolated stage.");
+		}
+	}
+	if (!mp->finish(Clock::now() + std::chrono::seconds(2))) {
+		return fail("child of the isolated stage did not exit on finish.");
+	}
+	return true;
+}
+
+// input blocks on the full socket of a child that does not read, finish kills it and input returns.
+static bool checkHang() {
+	std::shared_ptr<BaseMediaProcess> mp = isolated("CheckHang");
+	mp->setOutputHandler(0, [](std::shared_ptr<BaseMediaElement> me) {});
+	std::atomic<bool> done(false);
+	std::thread feeder([&]() {
+		try {
+			while (true) {
+				auto me = std::make_shared<BaseMediaElement>();
+				me->setMediaBuffer("data", std::make_shared<BaseMediaBuffer>(16 << 10));
+				mp->input(0, me);
+			}
+		} catch (const std::exception &e) {
+			// not running after finish.
+		}
+		done = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+	Clock::time_point begin = Clock::now();
+	bool exited = mp->finish(begin + std::chrono::milliseconds(500));
+	double seconds = std::chrono::duration_cast<std::chrono::duration<double> >(Clock::now() - begin).count();
+	bool returned = waitFor([&]() { return done.load(); });
+	feeder.join();
+	if (exited) {
+		return fail("hung child exited by itself.");
+	}
+	if (seconds > 2) {
+		return fail("finish with a hung child took " + std::to_string(seconds) + " s.");
+	}
+	if (!returned) {
+		return fail("input did not return after finish.");
+	}
+	return true;
+}
+
+// usage: mp_isolate_check
+int main(int argc, char const *argv[]) {
+	MediaStageRegistry::instance().add<CheckIdentity>("CheckIdentity");
+	MediaStageRegistry::instance().add<CheckHang>("CheckHang");
+	MediaStageRegistry::instance().add("isolated", MediaIsolatedPipe::create);
+	// before any thread starts.
+	MediaIsolateZygote::start();
+
+	if (!checkElement() || !checkHang()) {
+		return 1;
+	}
+	std::cout << "mp_isolate_check: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,225 @@
+#include <string>
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <functional>
+#include "media_element.h"
+#include "media_process.h"
+#include "media_net.h"
+
+// loopback check of MediaTcpSink to MediaTcpGenerator: elements arrive whole and in order, the sink
+// holds input when the receiver grants no credit, it connects again to a receiver that restarted,
+// and close ends the stream of the receiver. exits 1 on the first failure.
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t kWindow = 4;
+// every 8th element is large enough to be received straight into its buffer.
+static const size_t kLargeSize = 1 << 20;
+
+static bool fail(const std::string &what) {
+	std::cerr << "mp_net_check: " << what << std::endl;
+	return false;
+}
+
+// wait up to 5 s for done.
+static bool waitFor(const std::function<bool()> &done) {
+	Clock::time_point end = Clock::now() + std::chrono::seconds(5);
+	while (!done()) {
+		if (Clock::now() >= end) {
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+static std::shared_ptr<BaseMediaElement> makeElement(size_t index) {
+	auto me = std::make_shared<BaseMediaElement>();
+	me->setMetadata<size_t>("index", index);
+	me->setDeadline(Clock::now() + std::chrono::seconds(10));
+	size_t size = index % 8 == 7 ? kLargeSize : 1000 + index;
+	auto buffer = std::make_shared<BaseMediaBuffer>(size);
+	for (size_t i = 0; i < size; ++i) {
+		buffer->data()[i] = static_cast<uint8_t>(index + i);
+	}
+	me->setMediaBuffer("data", buffer);
+	return me;
+}
+
+static bool checkElement(const std::shared_ptr<BaseMediaElement> &me, size_t index) {
+	if (me->getMetadata<size_t>("index") != index) {
+		return fail("element " + std::to_string(index) + " out of order.");
+	}
+	// crosses as time left, rebased on arrival.
+	if (me->getDeadline() <= Clock::now() || me->getDeadline() > Clock::now() + std::chrono::seconds(10)) {
+		return fail("element " + std::to_string(index) + " deadline not kept.");
+	}
+	std::shared_ptr<BaseMediaBuffer> buffer = me->getMediaBuffer("data");
+	size_t size = index % 8 == 7 ? kLargeSize : 1000 + index;
+	if (!buffer || buffer->size() != size) {
+		return fail("element " + std::to_string(index) + " buffer size differs.");
+	}
+	for (size_t i = 0; i < size; ++i) {
+		if (buffer->data()[i] != static_cast<uint8_t>(index + i)) {
+			return fail("element " + std::to_string(index) + " buffer data differs.");
+		}
+	}
+	return true;
+}
+
+// receiver driven by its own thread, output handler may be held closed to stop granting credit.
+class Receiver {
+public:
+	Receiver(uint16_t port, const MediaNetOptions &options):
+		generator_(std::make_shared<MediaTcpGenerator>(port, "127.0.0.1", options)) {
+		generator_->setOutputHandler(0, [this](std::shared_ptr<BaseMediaElement> me) {
+			std::unique_lock<std::mutex> lock(mutex_);
+			while (held_) {
+				cond_.wait(lock);
+			}
+			elements_.emplace_back(me);
+		});
+		thread_ = std::thread([this]() {
+			while (generator_->generate()) {
+			}
+			ended_ = true;
+		});
+	}
+
+	~Receiver() {
+		hold(false);
+		generator_->interrupt();
+		thread_.join();
+	}
+
+	void hold(bool held) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		held_ = held;
+		cond_.notify_all();
+	}
+
+	size_t count() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		return elements_.size();
+	}
+
+	std::vector<std::shared_ptr<BaseMediaElement> > elements() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		return elements_;
+	}
+
+	uint16_t port() const {
+		return generator_->port();
+	}
+
+	bool ended() const {
+		return ended_;
+	}
+
+private:
+	std::shared_ptr<MediaTcpGenerator> generator_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	bool held_ = false;
+	std::vector<std::shared_ptr<BaseMediaElement> > elements_;
+	std::atomic<bool> ended_{false};
+	std::thread thread_;
+};
+
+// input count elements from first on a thread, counting those taken.
+static std::thread feed(MediaTcpSink &sink, size_t first, size_t count, std::atomic<size_t> &taken) {
+	return std::thread([&sink, first, count, &taken]() {
+		for (size_t i = first; i < first + count; ++i) {
+			sink.input(0, makeElement(i));
+			++taken;
+		}
+	});
+}
+
+static bool checkElements(Receiver &receiver, size_t first, size_t count) {
+	if (!waitFor([&]() { return receiver.count() >= count; })) {
+		return fail(std::to_string(receiver.count()) + " of " + std::to_string(count) + " elements arrived.");
+	}
+	std::vector<std::shared_ptr<BaseMediaElement> > elements = receiver.elements();
+	if (elements.size() != count) {
+		return fail(std::to_string(elements.size()) + " elements arrived, expect " + std::to_string(count) + ".");
+	}
+	for (size_t i = 0; i < count; ++i) {
+		if (!checkElement(elements[i], first + i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool run() {
+	MediaNetOptions options;
+	options.window = kWindow;
+	options.reconnectDelayMs = 20;
+	const size_t count = 64;
+
+	std::unique_ptr<Receiver> receiver(new Receiver(0, options));
+	uint16_t port = receiver->port();
+	MediaTcpSink sink("127.0.0.1", port, options);
+
+	// receiver holding its first element has granted the window only, one of it taken by that element.
+	receiver->hold(true);
+	std::atomic<size_t> taken(0);
+	std::thread feeder = feed(sink, 0, count, taken);
+	if (!waitFor([&]() { return taken.load() >= kWindow; })) {
+		receiver->hold(false);
+		feeder.join();
+		return fail("sink took " + std::to_string(taken.load()) + " elements, expect the window of " +
+		            std::to_string(kWindow) + ".");
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	size_t held = taken.load();
+	receiver->hold(false);
+	feeder.join();
+	if (held != kWindow) {
+		return fail("sink took " + std::to_string(held) + " elements without credit, window is " +
+		            std::to_string(kWindow) + ".");
+	}
+	if (!checkElements(*receiver, 0, count)) {
+		return false;
+	}
+	sink.flush();
+
+	// receiver restarts on the same port, the sink sees the link drop and connects again.
+	receiver.reset();
+	receiver.reset(new Receiver(port, options));
+	if (!waitFor([&]() { return sink.reconnects() >= 1; })) {
+		return fail("sink did not connect again.");
+	}
+	taken = 0;
+	feeder = feed(sink, count, count, taken);
+	feeder.join();
+	if (!checkElements(*receiver, count, count)) {
+		return false;
+	}
+
+	// close sends what is queued and ends the stream of the receiver.
+	sink.close();
+	if (!waitFor([&]() { return receiver->ended(); })) {
+		return fail("receiver stream did not end on close.");
+	}
+	if (sink.lost() != 0) {
+		return fail(std::to_string(sink.lost()) + " elements lost.");
+	}
+	return true;
+}
+
+// usage: mp_net_check
+int main(int argc, char const *argv[]) {
+	if (!run()) {
+		return 1;
+	}
+	std::cout << "mp_net_check: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef MEDIA_ALLOC_H_
+#define MEDIA_ALLOC_H_
+
+// heap allocation counting per stage, built with MEDIA_ALLOC_PROFILE only.
+// replaces global operator new, so include it in exactly one translation unit.
+
+#ifdef MEDIA_ALLOC_PROFILE
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "media_stats.h"
+
+// allocations made outside of any stage.
+inline std::atomic<uint64_t> &mediaUnattributedAllocs() {
+    static std::atomic<uint64_t> count{0};
+    return count;
+}
+
+inline void mediaRecordAlloc(const size_t &size) {
+    // recording may allocate itself, such as the first shard of a thread.
+    static thread_local bool recording = false;
+    if (recording) {
+        return;
+    }
+    recording = true;
+    MediaStageStats *stats = MediaStageStats::current();
+    if (stats) {
+        stats->recordHeapAlloc(size);
+    } else {
+        ++mediaUnattributedAllocs();
+    }
+    recording = false;
+}
+
+void *operator new(size_t size) {
+    void *p = ::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    mediaRecordAlloc(size);
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    ::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    ::free(p);
+}
+
+#endif  // MEDIA_ALLOC_PROFILE
+
+#endif  // MEDIA_ALLOC_H_
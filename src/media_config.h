@@ -0,0 +1,320 @@
+#ifndef MEDIA_CONFIG_H_
+#define MEDIA_CONFIG_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+// json parser includes boost/bind.hpp, which warns on its global placeholders otherwise.
+#ifndef BOOST_BIND_GLOBAL_PLACEHOLDERS
+#define BOOST_BIND_GLOBAL_PLACEHOLDERS
+#endif
+#include "boost/property_tree/json_parser.hpp"
+#include "boost/property_tree/ptree.hpp"
+#include "media_host.h"
+#include "media_placement.h"
+#include "media_process.h"
+
+// pipeline from a json description instead of code, stages made by factories registered by type name.
+//
+// {
+//     "name": "task001",
+//     "threads": 2,                                       runloop threads
+//     "quota": {"cpu": 1.0, "memory": 1073741824},        as a task of a host, see MediaTaskQuota
+//     "stages": [                                         levels, as arguments of a process constructor
+//         {"type": "MPProductor"},
+//         [{"type": "Detect", "threads": 4}, {"type": "Track"}],   stages in parallel
+//         {"type": "cache", "lowLevel": 8, "highLevel": 64},
+//         {"stages": [...]},                              composite, type from its ports
+//         {"type": "MPShow", "name": "show"}
+//     ]
+// }
+//
+// keys every stage takes: "name", "cpus" or "node" for placement. threaded pipes take "threads" or
+// "autoScale": {"min", "max", "idleMs"}, cache pipes "lowLevel" and "highLevel". other keys are
+// for the factory of the type.
+
+// the json object of a stage.
+class MediaStageParams {
+ public:
+    MediaStageParams() {}
+
+    explicit MediaStageParams(const boost::property_tree::ptree &tree): tree_(tree) {}
+
+    bool has(const std::string &key) const {
+        return tree_.get_child_optional(key).is_initialized();
+    }
+
+    template <typename T>
+    T get(const std::string &key, const T &value) const {
+        return tree_.get<T>(key, value);
+    }
+
+    template <typename T>
+    T get(const std::string &key) const {
+        if (!has(key)) {
+            throw std::runtime_error("stage param " + key + " missing.");
+        }
+        return tree_.get<T>(key);
+    }
+
+    // json array of values.
+    template <typename T>
+    std::vector<T> getList(const std::string &key) const {
+        std::vector<T> values;
+        auto child = tree_.get_child_optional(key);
+        if (child) {
+            for (auto &it : *child) {
+                values.emplace_back(it.second.get_value<T>());
+            }
+        }
+        return values;
+    }
+
+    const boost::property_tree::ptree &tree() const {
+        return tree_;
+    }
+
+ private:
+    boost::property_tree::ptree tree_;
+};
+
+// stage factories by type name, filled at start up, e.g. in main or by MEDIA_REGISTER_STAGE.
+class MediaStageRegistry {
+ public:
+    typedef std::function<std::shared_ptr<BaseMediaProcess>(const MediaStageParams &)> Factory;
+
+    static MediaStageRegistry &instance() {
+        static MediaStageRegistry registry;
+        return registry;
+    }
+
+    void add(const std::string &type, const Factory &factory) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        factories_[type] = factory;
+    }
+
+    // stage with default constructor, params only the common ones.
+    template <typename T>
+    void add(const std::string &type) {
+        add(type, [](const MediaStageParams &) -> std::shared_ptr<BaseMediaProcess> {
+            return std::make_shared<T>();
+        });
+    }
+
+    bool has(const std::string &type) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        return factories_.find(type) != factories_.end();
+    }
+
+    std::vector<std::string> types() {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        std::vector<std::string> types;
+        for (auto &it : factories_) {
+            types.emplace_back(it.first);
+        }
+        return types;
+    }
+
+    std::shared_ptr<BaseMediaProcess> create(const std::string &type, const MediaStageParams &params) {
+        Factory factory;
+        {
+            std::unique_lock<MediaMutex> lock(mutex_);
+            auto it = factories_.find(type);
+            if (it == factories_.end()) {
+                throw std::runtime_error("unknown stage type " + type + ".");
+            }
+            factory = it->second;
+        }
+        std::shared_ptr<BaseMediaProcess> mp = factory(params);
+        if (!mp) {
+            throw std::runtime_error("stage factory of " + type + " made nothing.");
+        }
+        return mp;
+    }
+
+ private:
+    MediaStageRegistry() {
+        // a cache stage, buffering between a fast and a slow stage.
+        add("cache", [](const MediaStageParams &params) -> std::shared_ptr<BaseMediaProcess> {
+            return std::make_shared<BaseMediaProcessCachePipe>(params.get<size_t>("lowLevel", 0),
+                                                               params.get<size_t>("highLevel", SIZE_MAX));
+        });
+    }
+
+    MediaMutex mutex_ MEDIA_LOCK_SITE("MediaStageRegistry::mutex_");
+    std::map<std::string, Factory> factories_;
+};
+
+struct MediaStageRegistrar {
+    MediaStageRegistrar(const std::string &type, const MediaStageRegistry::Factory &factory) {
+        MediaStageRegistry::instance().add(type, factory);
+    }
+};
+
+#define MEDIA_STAGE_CONCAT_(a, b) a##b
+#define MEDIA_STAGE_REGISTRAR_(line) MEDIA_STAGE_CONCAT_(mediaStageRegistrar, line)
+// register at static init, in the source defining the stage.
+#define MEDIA_REGISTER_STAGE(type, factory) \
+    static MediaStageRegistrar MEDIA_STAGE_REGISTRAR_(__LINE__)(type, factory)
+
+// sub stages composed from config, type by its ports as the composites in code are.
+class MediaComposedProcess: public BaseMediaProcess {
+ public:
+    explicit MediaComposedProcess(const MediaProcessLevels &levels): BaseMediaProcess(levels) {}
+
+    virtual const MediaProcessType getType() const {
+        size_t in = getInputCount();
+        size_t out = getOutputCount();
+        if (in == 0) {
+            return MediaProcessTypeGenerator;
+        }
+        if (out == 0) {
+            return MediaProcessTypeCollapsar;
+        }
+        if (in == 1 && out == 1) {
+            return MediaProcessTypePipe;
+        }
+        if (in == 1) {
+            return MediaProcessTypeSplit;
+        }
+        return out == 1 ? MediaProcessTypeJoin : MediaProcessTypeMultiplex;
+    }
+};
+
+class MediaPipelineConfig {
+ public:
+    static MediaPipelineConfig load(const std::string &path) {
+        MediaPipelineConfig config;
+        try {
+            boost::property_tree::read_json(path, config.tree_);
+        } catch (const boost::property_tree::json_parser_error &e) {
+            throw std::runtime_error("bad pipeline config " + path + ": " + e.what());
+        }
+        return config;
+    }
+
+    static MediaPipelineConfig parse(const std::string &json) {
+        MediaPipelineConfig config;
+        std::istringstream is(json);
+        try {
+            boost::property_tree::read_json(is, config.tree_);
+        } catch (const boost::property_tree::json_parser_error &e) {
+            throw std::runtime_error(std::string("bad pipeline config: ") + e.what());
+        }
+        return config;
+    }
+
+    const std::string name() const {
+        return tree_.get<std::string>("name", "pipeline");
+    }
+
+    // keys of "quota" not given are taken from defaults.
+    const MediaTaskQuota quota(const MediaTaskQuota &defaults = MediaTaskQuota()) const {
+        MediaTaskQuota quota = defaults;
+        quota.cpu = tree_.get<double>("quota.cpu", defaults.cpu);
+        quota.memory = tree_.get<size_t>("quota.memory", defaults.memory);
+        return quota;
+    }
+
+    // one stage as in "stages", started and placed as the pipeline would.
+    static std::shared_ptr<BaseMediaProcess> createStage(const MediaStageParams &params,
+        MediaStageRegistry &registry = MediaStageRegistry::instance()) {
+        return stage_(params.tree(), registry, "stage");
+    }
+
+    // runloop of the whole pipeline, threaded and cache stages started.
+    std::shared_ptr<BaseMediaProcessRunloop> build(
+        MediaStageRegistry &registry = MediaStageRegistry::instance()) const {
+        auto runloop = std::make_shared<BaseMediaProcessRunloop>(levels_(tree_, registry, "stages"));
+        runloop->setName(name());
+        if (tree_.get_child_optional("threads")) {
+            runloop->setThreadCount(tree_.get<size_t>("threads"));
+        }
+        runloop->setKeepAlive(tree_.get<bool>("keepAlive", false));
+        return runloop;
+    }
+
+ private:
+    static MediaProcessLevels levels_(const boost::property_tree::ptree &tree, MediaStageRegistry &registry,
+                                      const std::string &path) {
+        auto stages = tree.get_child_optional("stages");
+        if (!stages || stages->empty()) {
+            throw std::runtime_error("no stages in " + path + ".");
+        }
+        MediaProcessLevels levels;
+        size_t index = 0;
+        for (auto &level : *stages) {
+            std::string at = path + "[" + std::to_string(index++) + "]";
+            std::vector<std::shared_ptr<BaseMediaProcess> > mps;
+            if (isStage_(level.second)) {
+                mps.emplace_back(stage_(level.second, registry, at));
+            } else {
+                size_t i = 0;
+                for (auto &stage : level.second) {
+                    mps.emplace_back(stage_(stage.second, registry, at + "[" + std::to_string(i++) + "]"));
+                }
+            }
+            levels.emplace_back(mps);
+        }
+        return levels;
+    }
+
+    // object, json arrays have children without keys.
+    static bool isStage_(const boost::property_tree::ptree &tree) {
+        return tree.get_child_optional("type") || tree.get_child_optional("stages");
+    }
+
+    static std::shared_ptr<BaseMediaProcess> stage_(const boost::property_tree::ptree &tree,
+                                                    MediaStageRegistry &registry, const std::string &path) {
+        MediaStageParams params(tree);
+        std::shared_ptr<BaseMediaProcess> mp;
+        std::string type = params.get<std::string>("type", "composite");
+        try {
+            if (type == "composite") {
+                mp = std::make_shared<MediaComposedProcess>(levels_(tree, registry, path));
+            } else {
+                mp = registry.create(type, params);
+            }
+            apply_(mp, params);
+        } catch (const boost::property_tree::ptree_error &e) {
+            throw std::runtime_error("bad param of " + path + " " + type + ": " + e.what());
+        }
+        return mp;
+    }
+
+    static void apply_(const std::shared_ptr<BaseMediaProcess> &mp, const MediaStageParams &params) {
+        if (params.has("name")) {
+            mp->setName(params.get<std::string>("name"));
+        }
+        if (params.has("cpus")) {
+            mp->setPlacement(MediaPlacement::onCpus(params.getList<int>("cpus")));
+        } else if (params.has("node")) {
+            mp->setPlacement(MediaPlacement::onNode(params.get<int>("node")));
+        }
+
+        if (auto pipe = std::dynamic_pointer_cast<BaseMediaProcessThreadedPipe>(mp)) {
+            if (params.has("threads")) {
+                pipe->setThreadCount(params.get<size_t>("threads"));
+            }
+            if (params.has("autoScale")) {
+                pipe->setAutoScale(params.get<size_t>("autoScale.min", 1), params.get<size_t>("autoScale.max", 1),
+                                   params.get<size_t>("autoScale.idleMs", 1000));
+            }
+            pipe->start();
+        } else if (auto cache = std::dynamic_pointer_cast<BaseMediaProcessCachePipe>(mp)) {
+            if (params.has("lowLevel") || params.has("highLevel")) {
+                cache->setLevels(params.get<size_t>("lowLevel", 0), params.get<size_t>("highLevel", SIZE_MAX));
+            }
+            cache->start();
+        }
+    }
+
+    boost::property_tree::ptree tree_;
+};
+
+#endif  // MEDIA_CONFIG_H_
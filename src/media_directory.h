@@ -0,0 +1,324 @@
+#ifndef MEDIA_DIRECTORY_H_
+#define MEDIA_DIRECTORY_H_
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "media_element.h"
+#include "media_process.h"
+
+enum MediaDirectoryOrder {
+    // sorted by path, emitting starts when the walk is done.
+    MediaDirectoryOrderStable = 1,
+    // as found by the walkers, emitting starts at once.
+    MediaDirectoryOrderAny = 2,
+};
+
+struct MediaDirectoryOptions {
+    // globs matched against file name, e.g. "*.jpg", all files if empty.
+    std::vector<std::string> patterns;
+    bool recursive = true;
+    MediaDirectoryOrder order = MediaDirectoryOrderStable;
+    // this job takes files whose path hash modulo shardCount is shardIndex, for jobs split over processes.
+    size_t shardIndex = 0;
+    size_t shardCount = 1;
+    size_t scanThreads = 4;
+    size_t readThreads = 8;
+    // files read ahead of the one emitted, bounded by count and bytes.
+    size_t readAheadFiles = 64;
+    size_t readAheadBytes = 256 << 20;
+};
+
+// walks directory trees in parallel and reads files ahead of consumption, so walk and io latency
+// hide behind processing. element has "file" buffer with whole content, "path" and "size" metadata.
+class MediaDirectoryGenerator: public BaseMediaProcessGenerator {
+ public:
+    MediaDirectoryGenerator(const std::vector<std::string> &roots,
+                            const MediaDirectoryOptions &options = MediaDirectoryOptions()):
+        options_(options) {
+        if (!options_.shardCount || options_.shardIndex >= options_.shardCount) {
+            throw std::runtime_error("bad shard of directory scan.");
+        }
+        for (auto &root : roots) {
+            dirs_.emplace_back(root);
+        }
+        if (dirs_.empty()) {
+            scanning_ = false;
+            published_ = true;
+        }
+        for (size_t i = 0; i < std::max<size_t>(options_.scanThreads, 1); ++i) {
+            threads_.emplace_back(&MediaDirectoryGenerator::scanLoop_, this);
+        }
+        for (size_t i = 0; i < std::max<size_t>(options_.readThreads, 1); ++i) {
+            threads_.emplace_back(&MediaDirectoryGenerator::readLoop_, this);
+        }
+    }
+
+    ~MediaDirectoryGenerator() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stopped_ = true;
+            cond_.notify_all();
+        }
+        for (auto &t : threads_) {
+            t.join();
+        }
+    }
+
+    virtual const size_t getInputCount() const {
+        return 0;
+    }
+
+    virtual const size_t getOutputCount() const {
+        return 1;
+    }
+
+    // files found so far, all of them once the walk is done.
+    const size_t fileCount() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return files_.size() + pendingFiles_.size();
+    }
+
+    virtual bool generate() {
+        Ready ready;
+        std::string path;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!stopped_ && ready_.find(emitted_) == ready_.end() && !(published_ && emitted_ == files_.size())) {
+                readyCond_.wait(lock);
+            }
+            auto it = ready_.find(emitted_);
+            if (stopped_ || it == ready_.end()) {
+                return false;
+            }
+            ready = it->second;
+            ready_.erase(it);
+            path = files_[emitted_];
+            ++emitted_;
+            aheadBytes_ -= ready.buffer ? ready.buffer->size() : 0;
+            cond_.notify_all();
+        }
+        if (!ready.error.empty()) {
+            throw std::runtime_error(ready.error);
+        }
+
+        auto me = std::make_shared<BaseMediaElement>();
+        me->setMediaBuffer("file", ready.buffer);
+        me->setMetadata<std::string>("path", path);
+        me->setMetadata<size_t>("size", ready.buffer->size());
+        outputHandlers_[0](me);
+        return true;
+    }
+
+    virtual void interrupt() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopped_ = true;
+        cond_.notify_all();
+        readyCond_.notify_all();
+    }
+
+ private:
+    struct Ready {
+        std::shared_ptr<BaseMediaBuffer> buffer;
+        std::string error;
+    };
+
+    // fnv-1a, same on every host so shards of a job split over machines agree.
+    static uint64_t hash_(const std::string &path) {
+        uint64_t h = 14695981039346656037ULL;
+        for (auto c : path) {
+            h ^= static_cast<uint8_t>(c);
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    bool match_(const char *name) const {
+        if (options_.patterns.empty()) {
+            return true;
+        }
+        for (auto &pattern : options_.patterns) {
+            if (::fnmatch(pattern.c_str(), name, 0) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // one directory, found sub directories and files returned to caller.
+    void scan_(const std::string &dir, std::vector<std::string> &dirs, std::vector<std::string> &files) const {
+        DIR *d = ::opendir(dir.c_str());
+        if (!d) {
+            std::cerr << "can not open directory " << dir << ": " << ::strerror(errno) << std::endl;
+            return;
+        }
+        while (struct dirent *entry = ::readdir(d)) {
+            const char *name = entry->d_name;
+            if (::strcmp(name, ".") == 0 || ::strcmp(name, "..") == 0) {
+                continue;
+            }
+            std::string path = dir + (dir.back() == '/' ? "" : "/") + name;
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN || type == DT_LNK) {
+                // file systems without d_type, and links followed to what they point.
+                struct stat st;
+                if (::stat(path.c_str(), &st) < 0) {
+                    continue;
+                }
+                type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+                // links to directories are not followed, they may loop.
+                if (entry->d_type == DT_LNK && type == DT_DIR) {
+                    continue;
+                }
+            }
+            if (type == DT_DIR) {
+                if (options_.recursive) {
+                    dirs.emplace_back(path);
+                }
+            } else if (type == DT_REG && match_(name) &&
+                       hash_(path) % options_.shardCount == options_.shardIndex) {
+                files.emplace_back(path);
+            }
+        }
+        ::closedir(d);
+    }
+
+    void scanLoop_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            while (dirs_.empty() && scanning_ && !stopped_) {
+                cond_.wait(lock);
+            }
+            if (stopped_ || (dirs_.empty() && !scanning_)) {
+                return;
+            }
+            if (dirs_.empty()) {
+                continue;
+            }
+            std::string dir = dirs_.front();
+            dirs_.pop_front();
+            ++scanners_;
+            lock.unlock();
+
+            std::vector<std::string> dirs;
+            std::vector<std::string> files;
+            scan_(dir, dirs, files);
+
+            lock.lock();
+            --scanners_;
+            for (auto &d : dirs) {
+                dirs_.emplace_back(d);
+            }
+            if (options_.order == MediaDirectoryOrderAny) {
+                files_.insert(files_.end(), files.begin(), files.end());
+            } else {
+                pendingFiles_.insert(pendingFiles_.end(), files.begin(), files.end());
+            }
+            if (dirs_.empty() && scanners_ == 0 && scanning_) {
+                // walk done.
+                scanning_ = false;
+                if (options_.order == MediaDirectoryOrderStable) {
+                    std::sort(pendingFiles_.begin(), pendingFiles_.end());
+                    files_.swap(pendingFiles_);
+                }
+                published_ = true;
+                readyCond_.notify_all();
+            }
+            cond_.notify_all();
+        }
+    }
+
+    static Ready read_(const std::string &path) {
+        Ready ready;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) < 0) {
+            ready.error = "can not open " + path + ": " + ::strerror(errno);
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            return ready;
+        }
+        ready.buffer = std::make_shared<BaseMediaBuffer>(static_cast<size_t>(st.st_size));
+        size_t done = 0;
+        while (done < ready.buffer->size()) {
+            ssize_t n = ::pread(fd, ready.buffer->data() + done, ready.buffer->size() - done, done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                ready.error = "can not read " + path;
+                break;
+            }
+            done += n;
+        }
+        ::close(fd);
+        return ready;
+    }
+
+    // files are read in emit order within the window, so emitting waits little.
+    void readLoop_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            while (!stopped_ && !(reading_ < files_.size() && reading_ - emitted_ < options_.readAheadFiles &&
+                                  aheadBytes_ < options_.readAheadBytes) && !(published_ && reading_ >= files_.size())) {
+                cond_.wait(lock);
+            }
+            if (stopped_ || reading_ >= files_.size()) {
+                return;
+            }
+            uint64_t seq = reading_++;
+            std::string path = files_[seq];
+            lock.unlock();
+
+            Ready ready = read_(path);
+
+            lock.lock();
+            aheadBytes_ += ready.buffer ? ready.buffer->size() : 0;
+            ready_[seq] = ready;
+            if (seq == emitted_) {
+                readyCond_.notify_all();
+            }
+        }
+    }
+
+    MediaDirectoryOptions options_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::condition_variable readyCond_;
+    bool stopped_ = false;
+
+    // walk
+    std::deque<std::string> dirs_;
+    size_t scanners_ = 0;
+    bool scanning_ = true;
+    // files to emit in order, complete when published.
+    std::deque<std::string> files_;
+    std::deque<std::string> pendingFiles_;
+    bool published_ = false;
+
+    // read ahead
+    uint64_t reading_ = 0;
+    uint64_t emitted_ = 0;
+    size_t aheadBytes_ = 0;
+    std::map<uint64_t, Ready> ready_;
+};
+
+#endif  // MEDIA_DIRECTORY_H_
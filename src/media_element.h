@@ -2,33 +2,127 @@
 #define MEDIA_ELEMENT_H_
 
 #include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
+#include <vector>
 #include <map>
 #include "boost/thread.hpp"
 #include "boost/archive/text_iarchive.hpp"
 #include "boost/archive/text_oarchive.hpp"
+#include "media_stats.h"
+#include "media_lock.h"
+
+// bytes held by buffers and cpu time used by one owner (a task for example).
+class MediaMemoryAccount {
+ public:
+    void add(const int64_t &bytes) {
+        bytes_ += bytes;
+    }
+
+    const int64_t bytes() const {
+        return bytes_.load();
+    }
+
+    void addCpuNs(const int64_t &ns) {
+        cpuNs_ += ns;
+    }
+
+    // cpu time since last take, in nanoseconds.
+    const int64_t cpuNs() const {
+        return cpuNs_.load();
+    }
+
+    int64_t takeCpuNs() {
+        return cpuNs_.exchange(0);
+    }
+
+    static int64_t threadCpuNs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    // account charged by buffers created in current thread, nullptr for none.
+    static std::shared_ptr<MediaMemoryAccount> &current() {
+        static thread_local std::shared_ptr<MediaMemoryAccount> account;
+        return account;
+    }
+
+ private:
+    std::atomic<int64_t> bytes_{0};
+    std::atomic<int64_t> cpuNs_{0};
+};
+
+// charge buffers created in this scope to account, and cpu time of this thread in it unless an
+// outer scope of the thread charges it already.
+class MediaMemoryAccountScope {
+ public:
+    explicit MediaMemoryAccountScope(const std::shared_ptr<MediaMemoryAccount> &account) {
+        prev_.swap(MediaMemoryAccount::current());
+        MediaMemoryAccount::current() = account;
+        if (account && !prev_) {
+            account_ = account;
+            begin_ = MediaMemoryAccount::threadCpuNs();
+        }
+    }
+
+    ~MediaMemoryAccountScope() {
+        if (account_) {
+            account_->addCpuNs(MediaMemoryAccount::threadCpuNs() - begin_);
+        }
+        MediaMemoryAccount::current().swap(prev_);
+    }
+
+ private:
+    std::shared_ptr<MediaMemoryAccount> prev_;
+    std::shared_ptr<MediaMemoryAccount> account_;
+    int64_t begin_ = 0;
+};
 
 class BaseMediaBuffer {
  public:
-    BaseMediaBuffer(const size_t &size):size_(size) {
+    BaseMediaBuffer(const size_t &size):size_(size), account_(MediaMemoryAccount::current()) {
         if (size_) {
             data_ = new uint8_t[size_];
         } else {
             data_ = nullptr;
         }
+        if (account_) {
+            account_->add(size_);
+        }
+        if (MediaStageStats::current()) {
+            MediaStageStats::current()->recordBufferAlloc(size_);
+        }
     }
 
     virtual ~BaseMediaBuffer() {
-        if (data_) {
+        if (data_ && owned_) {
             delete [] data_;
         }
+        if (account_) {
+            account_->add(-static_cast<int64_t>(size_));
+        }
     }
 
     void resize(const size_t &size) {
         uint8_t *newData = new uint8_t[size];
         size_t copyLength = std::min(size, size_);
         ::memcpy(newData, data_, copyLength);
-        delete [] data_;
+        if (MediaStageStats::current()) {
+            MediaStageStats::current()->recordBufferAlloc(size);
+            MediaStageStats::current()->recordBufferCopy(copyLength);
+        }
+        if (owned_) {
+            delete [] data_;
+        }
+        owned_ = true;
+        if (account_) {
+            account_->add(static_cast<int64_t>(size) - static_cast<int64_t>(size_));
+        }
         data_ = newData;
         size_ = size;
     }
@@ -42,14 +136,143 @@ class BaseMediaBuffer {
     }
 
  protected:
+    // view of memory owned by others, it is not freed nor charged, resize copies it out.
+    BaseMediaBuffer(uint8_t *data, const size_t &size): size_(size), data_(data), owned_(false) {}
+
     size_t size_;
     uint8_t *data_;
+    bool owned_ = true;
+    std::shared_ptr<MediaMemoryAccount> account_;
+
+ private:
+    friend class BaseMediaBufferPool;
+
+    // move charged bytes to another account.
+    void setAccount_(const std::shared_ptr<MediaMemoryAccount> &account) {
+        if (account_) {
+            account_->add(-static_cast<int64_t>(size_));
+        }
+        account_ = account;
+        if (account_) {
+            account_->add(size_);
+        }
+    }
+};
+
+// first size bytes of another buffer, e.g. a pooled one larger than needed, kept alive while the view is.
+class MediaBufferView: public BaseMediaBuffer {
+ public:
+    MediaBufferView(const std::shared_ptr<BaseMediaBuffer> &buffer, const size_t &size):
+        BaseMediaBuffer(buffer->data(), std::min(size, buffer->size())), buffer_(buffer) {}
+
+    const std::shared_ptr<BaseMediaBuffer> &buffer() const {
+        return buffer_;
+    }
+
+ private:
+    std::shared_ptr<BaseMediaBuffer> buffer_;
+};
+
+// fixed size buffers recycled instead of freed, can be shared between tasks.
+class BaseMediaBufferPool: public std::enable_shared_from_this<BaseMediaBufferPool> {
+ public:
+    BaseMediaBufferPool(const size_t &bufferSize, const size_t &maxFree = 64):
+        bufferSize_(bufferSize), maxFree_(maxFree) {}
+
+    // buffer goes back to pool when last reference released.
+    std::shared_ptr<BaseMediaBuffer> acquire() {
+        BaseMediaBuffer *buffer = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!free_.empty()) {
+                buffer = free_.back();
+                free_.pop_back();
+            }
+        }
+        ++acquireCount_;
+        if (buffer) {
+            ++reuseCount_;
+            buffer->setAccount_(MediaMemoryAccount::current());
+        } else {
+            buffer = new BaseMediaBuffer(bufferSize_);
+        }
+
+        std::weak_ptr<BaseMediaBufferPool> pool = shared_from_this();
+        return std::shared_ptr<BaseMediaBuffer>(buffer, [pool](BaseMediaBuffer *b) {
+            std::shared_ptr<BaseMediaBufferPool> p = pool.lock();
+            if (!p || !p->release_(b)) {
+                delete b;
+            }
+        });
+    }
+
+    const size_t bufferSize() const {
+        return bufferSize_;
+    }
+
+    const size_t freeCount() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return free_.size();
+    }
+
+    // acquisitions since created, reused ones did not allocate.
+    const uint64_t acquireCount() const {
+        return acquireCount_.load(std::memory_order_relaxed);
+    }
+
+    const uint64_t reuseCount() const {
+        return reuseCount_.load(std::memory_order_relaxed);
+    }
+
+    ~BaseMediaBufferPool() {
+        for (auto b : free_) {
+            delete b;
+        }
+    }
+
+ private:
+    bool release_(BaseMediaBuffer *buffer) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // size may changed by resize.
+        if (free_.size() >= maxFree_ || buffer->size() != bufferSize_) {
+            return false;
+        }
+        buffer->setAccount_(nullptr);
+        free_.emplace_back(buffer);
+        return true;
+    }
+
+    size_t bufferSize_;
+    size_t maxFree_;
+    std::mutex mutex_;
+    std::vector<BaseMediaBuffer *> free_;
+    std::atomic<uint64_t> acquireCount_{0};
+    std::atomic<uint64_t> reuseCount_{0};
 };
 
+// raw metadata name of the element deadline.
+static const char *const kMediaDeadlineKey = "deadline";
+
 class BaseMediaElement {
  public:
+    BaseMediaElement(): id_(nextId_()), account_(MediaMemoryAccount::current()) {
+        if (MediaStageStats::current()) {
+            MediaStageStats::current()->recordElementCreated();
+        }
+    }
+
+    // unique in process, used to follow an element through stages.
+    const uint64_t id() const {
+        return id_;
+    }
+
+    // account current where it was created, stage threads working on the element charge it.
+    const std::shared_ptr<MediaMemoryAccount> &account() const {
+        return account_;
+    }
+
     std::shared_ptr<BaseMediaBuffer> getMediaBuffer(const std::string &name) {
-        boost::shared_lock<boost::shared_mutex> rlock(mediaDataMutex_);
+        boost::shared_lock<MediaSharedMutex> rlock(mediaDataMutex_);
         auto it = mediaData_.find(name);
         if (it != mediaData_.end()) {
             return it->second;
@@ -59,10 +282,48 @@ class BaseMediaElement {
     }
 
     void setMediaBuffer(const std::string &name, const std::shared_ptr<BaseMediaBuffer> &mediaBuffer) {
-        boost::unique_lock<boost::shared_mutex> wlock(mediaDataMutex_);
+        boost::unique_lock<MediaSharedMutex> wlock(mediaDataMutex_);
         mediaData_[name] = mediaBuffer;
     }
 
+    const std::map<std::string, std::shared_ptr<BaseMediaBuffer> > getMediaBuffers() const {
+        boost::shared_lock<MediaSharedMutex> rlock(mediaDataMutex_);
+        return mediaData_;
+    }
+
+    // total size of all media buffers.
+    const size_t getMediaBufferBytes() const {
+        boost::shared_lock<MediaSharedMutex> rlock(mediaDataMutex_);
+        size_t bytes = 0;
+        for (auto &it : mediaData_) {
+            if (it.second) {
+                bytes += it.second->size();
+            }
+        }
+        return bytes;
+    }
+
+    bool hasMetadata(const std::string &name) const {
+        boost::shared_lock<MediaSharedMutex> rlock(metadataMutex_);
+        return metadata_.find(name) != metadata_.end();
+    }
+
+    // element should be processed before deadline, or it can be dropped. stages read it on every hop,
+    // so it is kept typed, and is in raw metadata only for elements crossing a process.
+    void setDeadline(const std::chrono::steady_clock::time_point &deadline) {
+        deadline_.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    // time_point::max() if no deadline.
+    const std::chrono::steady_clock::time_point getDeadline() const {
+        return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(
+            deadline_.load(std::memory_order_relaxed)));
+    }
+
+    bool hasDeadline() const {
+        return getDeadline() != std::chrono::steady_clock::time_point::max();
+    }
+
     template <typename T>
     const T getMetadata(const std::string &name) const {
         T v;
@@ -72,7 +333,7 @@ class BaseMediaElement {
 
     template <typename T>
     void getMetadata(const std::string &name, T *out) const {
-        boost::shared_lock<boost::shared_mutex> rlock(metadataMutex_);
+        boost::shared_lock<MediaSharedMutex> rlock(metadataMutex_);
         auto it = metadata_.find(name);
         if (it != metadata_.end()) {
             std::istringstream is(it->second);
@@ -83,21 +344,65 @@ class BaseMediaElement {
         }
     }
 
+    // metadata as stored, serialized values, to copy or persist elements without knowing the types.
+    // deadline is in it as int64 nanoseconds left till it under kMediaDeadlineKey, negative if passed,
+    // rebased on now by setRawMetadata, as steady clocks of two processes or hosts differ.
+    const std::map<std::string, std::string> getRawMetadata() const {
+        std::map<std::string, std::string> metadata;
+        {
+            boost::shared_lock<MediaSharedMutex> rlock(metadataMutex_);
+            metadata = metadata_;
+        }
+        if (hasDeadline()) {
+            std::ostringstream os;
+            boost::archive::text_oarchive oa(os);
+            int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                getDeadline() - std::chrono::steady_clock::now()).count();
+            oa << ns;
+            metadata[kMediaDeadlineKey] = os.str();
+        }
+        return metadata;
+    }
+
+    void setRawMetadata(const std::string &name, const std::string &value) {
+        if (name == kMediaDeadlineKey) {
+            std::istringstream is(value);
+            boost::archive::text_iarchive ia(is);
+            int64_t ns;
+            ia >> ns;
+            setDeadline(std::chrono::steady_clock::now() +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(ns)));
+            return;
+        }
+        boost::unique_lock<MediaSharedMutex> wlock(metadataMutex_);
+        metadata_[name] = value;
+    }
+
     template <typename T>
     void setMetadata(const std::string &name, const T &value) {
         std::ostringstream os;
         boost::archive::text_oarchive oa(os);
         oa << value;
-        boost::unique_lock<boost::shared_mutex> wlock(metadataMutex_);
+        boost::unique_lock<MediaSharedMutex> wlock(metadataMutex_);
         metadata_[name] = os.str();
     }
 
  private:
-    mutable boost::shared_mutex metadataMutex_;
+    static uint64_t nextId_() {
+        static std::atomic<uint64_t> id{0};
+        return ++id;
+    }
+
+    uint64_t id_;
+    std::shared_ptr<MediaMemoryAccount> account_;
+    // steady clock ticks, those of time_point::max() for none.
+    std::atomic<std::chrono::steady_clock::rep> deadline_{std::chrono::steady_clock::time_point::max().time_since_epoch().count()};
+
+    mutable MediaSharedMutex metadataMutex_ MEDIA_LOCK_SITE("BaseMediaElement::metadataMutex_");
     std::map<std::string, std::string> metadata_;
 
-    mutable boost::shared_mutex mediaDataMutex_;
+    mutable MediaSharedMutex mediaDataMutex_ MEDIA_LOCK_SITE("BaseMediaElement::mediaDataMutex_");
     std::map<std::string, std::shared_ptr<BaseMediaBuffer> > mediaData_;
 };
 
-#endif  // MEDIA_ELEMENT_H_
\ No newline at end of file
+#endif  // MEDIA_ELEMENT_H_
\ No newline at end of file
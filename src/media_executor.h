@@ -0,0 +1,132 @@
+#ifndef MEDIA_EXECUTOR_H_
+#define MEDIA_EXECUTOR_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include "media_lock.h"
+
+// threads shared by many pipes, run work earliest deadline first.
+// work without deadline (time_point::max()) run after all deadlines, in submit order.
+class MediaDeadlineExecutor {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit MediaDeadlineExecutor(const size_t threadCount = 1) {
+        running_ = true;
+        for (size_t i = 0; i < threadCount; ++i) {
+            threads_.emplace_back(&MediaDeadlineExecutor::run_, this);
+        }
+    }
+
+    ~MediaDeadlineExecutor() {
+        stop();
+    }
+
+    // onExpired is called instead of work if deadline passed before work begin.
+    // false once stopped, neither is called then.
+    bool submit(const Clock::time_point &deadline, std::function<void()> work,
+                std::function<void()> onExpired = nullptr) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        if (!running_) {
+            return false;
+        }
+        Work w;
+        w.deadline = deadline;
+        w.seq = seq_++;
+        w.work = work;
+        w.onExpired = onExpired;
+        queue_.push(w);
+        cond_.notify_one();
+        return true;
+    }
+
+    // false for time_point::max(), which means no deadline.
+    static bool expired(const Clock::time_point &deadline) {
+        return deadline != Clock::time_point::max() && deadline < Clock::now();
+    }
+
+    const size_t missCount() const {
+        return missCount_.load();
+    }
+
+    const size_t pendingCount() {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        return queue_.size();
+    }
+
+    // pending work still run before threads exit.
+    void stop() {
+        std::vector<std::thread> ts;
+        {
+            std::unique_lock<MediaMutex> lock(mutex_);
+            running_ = false;
+            cond_.notify_all();
+            ts.swap(threads_);
+        }
+
+        for (auto &t : ts) {
+            if (t.joinable()) {
+                t.join();
+            }
+        }
+    }
+
+ private:
+    struct Work {
+        Clock::time_point deadline;
+        uint64_t seq;
+        std::function<void()> work;
+        std::function<void()> onExpired;
+
+        bool operator>(const Work &other) const {
+            if (deadline != other.deadline) {
+                return deadline > other.deadline;
+            }
+            return seq > other.seq;
+        }
+    };
+
+    void run_() {
+        while (true) {
+            Work w;
+            {
+                std::unique_lock<MediaMutex> lock(mutex_);
+                while (running_ && queue_.empty()) {
+                    cond_.wait(lock);
+                }
+                if (queue_.empty()) {
+                    break;
+                }
+                w = queue_.top();
+                queue_.pop();
+            }
+
+            if (expired(w.deadline)) {
+                ++missCount_;
+                if (w.onExpired) {
+                    w.onExpired();
+                }
+            } else {
+                w.work();
+            }
+        }
+    }
+
+    bool running_ = false;
+    MediaMutex mutex_ MEDIA_LOCK_SITE("MediaDeadlineExecutor::mutex_");
+    MediaCondition cond_;
+    std::vector<std::thread> threads_;
+
+    uint64_t seq_ = 0;
+    std::priority_queue<Work, std::vector<Work>, std::greater<Work> > queue_;
+    std::atomic<size_t> missCount_{0};
+};
+
+#endif  // MEDIA_EXECUTOR_H_
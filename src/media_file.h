@@ -0,0 +1,215 @@
+#ifndef MEDIA_FILE_H_
+#define MEDIA_FILE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "media_element.h"
+#include "media_mmap.h"
+#include "media_process.h"
+
+// frames or packets of a mapped file, each element has a buffer viewing into the mapping,
+// so nothing is read or copied, pages come from read ahead of the kernel.
+// metadata: "index" of frame, "width" and "height" for y4m.
+class MediaFileGenerator: public BaseMediaProcessGenerator {
+ public:
+    // raw yuv or rgb, frame size is width * height * bytes per pixel, e.g. * 3 / 2 for yuv420p.
+    static std::shared_ptr<MediaFileGenerator> raw(const std::string &path, const size_t &frameSize) {
+        if (!frameSize) {
+            throw std::runtime_error("frame size is 0.");
+        }
+        std::shared_ptr<MediaFileGenerator> generator(new MediaFileGenerator(path));
+        generator->frameSize_ = frameSize;
+        return generator;
+    }
+
+    // fixed size packets, e.g. 188 for mpeg ts, count packets per element, fewer in last one.
+    static std::shared_ptr<MediaFileGenerator> packets(const std::string &path, const size_t &packetSize,
+                                                       const size_t &count = 1) {
+        if (!packetSize || !count) {
+            throw std::runtime_error("packet size or count is 0.");
+        }
+        std::shared_ptr<MediaFileGenerator> generator(new MediaFileGenerator(path));
+        generator->frameSize_ = packetSize * count;
+        generator->packetSize_ = packetSize;
+        return generator;
+    }
+
+    // yuv4mpeg2, frame size from stream header.
+    static std::shared_ptr<MediaFileGenerator> y4m(const std::string &path) {
+        std::shared_ptr<MediaFileGenerator> generator(new MediaFileGenerator(path));
+        generator->parseY4m_();
+        return generator;
+    }
+
+    virtual const size_t getInputCount() const {
+        return 0;
+    }
+
+    virtual const size_t getOutputCount() const {
+        return 1;
+    }
+
+    // buffer name of element, "frame" by default.
+    void setBufferName(const std::string &name) {
+        bufferName_ = name;
+    }
+
+    // bytes advised to be read ahead of current frame.
+    void setReadAhead(const size_t &bytes) {
+        readAhead_ = bytes;
+    }
+
+    const size_t frameSize() const {
+        return frameSize_;
+    }
+
+    const size_t width() const {
+        return width_;
+    }
+
+    const size_t height() const {
+        return height_;
+    }
+
+    // frame rate of y4m as numerator and denominator, 0 if unknown.
+    const std::pair<size_t, size_t> frameRate() const {
+        return frameRate_;
+    }
+
+    virtual bool generate() {
+        if (interrupted_) {
+            return false;
+        }
+
+        size_t offset = offset_;
+        size_t size = frameSize_;
+        if (y4m_) {
+            // FRAME with optional parameters, till new line.
+            const size_t kFrameTag = 5;
+            if (offset + kFrameTag > file_->size() || ::memcmp(file_->data() + offset, "FRAME", kFrameTag) != 0) {
+                return false;
+            }
+            const uint8_t *end = static_cast<const uint8_t *>(
+                ::memchr(file_->data() + offset, '\n', std::min<size_t>(file_->size() - offset, 1024)));
+            if (!end) {
+                return false;
+            }
+            offset = end + 1 - file_->data();
+        } else if (packetSize_ && offset + size > file_->size()) {
+            // last element takes the whole packets left.
+            size = (file_->size() - offset) / packetSize_ * packetSize_;
+            if (!size) {
+                return false;
+            }
+        }
+        if (offset + size > file_->size()) {
+            return false;
+        }
+        offset_ = offset + size;
+
+        if (offset_ + readAhead_ / 2 > advised_) {
+            advised_ = offset_ + readAhead_;
+            file_->advise(MADV_WILLNEED, offset_, readAhead_);
+        }
+
+        auto me = std::make_shared<BaseMediaElement>();
+        me->setMediaBuffer(bufferName_, std::make_shared<MediaMappedBuffer>(file_, offset, size));
+        me->setMetadata<size_t>("index", index_++);
+        if (y4m_) {
+            me->setMetadata<size_t>("width", width_);
+            me->setMetadata<size_t>("height", height_);
+        }
+        outputHandlers_[0](me);
+        return true;
+    }
+
+    virtual void interrupt() {
+        interrupted_ = true;
+    }
+
+ private:
+    explicit MediaFileGenerator(const std::string &path): file_(MediaMappedFile::open(path)) {
+        file_->advise(MADV_SEQUENTIAL);
+    }
+
+    // YUV4MPEG2 W<w> H<h> F<n>:<d> I<i> A<a> C<c> X<x>
+    void parseY4m_() {
+        const char kMagic[] = "YUV4MPEG2 ";
+        const size_t magicSize = sizeof(kMagic) - 1;
+        const uint8_t *data = file_->data();
+        const uint8_t *end = static_cast<const uint8_t *>(
+            data ? ::memchr(data, '\n', std::min<size_t>(file_->size(), 4096)) : nullptr);
+        if (!end || static_cast<size_t>(end - data) < magicSize || ::memcmp(data, kMagic, magicSize) != 0) {
+            throw std::runtime_error("not a y4m file " + file_->path());
+        }
+
+        std::istringstream header(std::string(reinterpret_cast<const char *>(data) + magicSize,
+                                              reinterpret_cast<const char *>(end)));
+        std::string colorspace = "420jpeg";
+        std::string token;
+        while (header >> token) {
+            switch (token[0]) {
+                case 'W': width_ = std::stoul(token.substr(1)); break;
+                case 'H': height_ = std::stoul(token.substr(1)); break;
+                case 'C': colorspace = token.substr(1); break;
+                case 'F': {
+                    size_t colon = token.find(':');
+                    if (colon != std::string::npos) {
+                        frameRate_.first = std::stoul(token.substr(1, colon - 1));
+                        frameRate_.second = std::stoul(token.substr(colon + 1));
+                    }
+                    break;
+                }
+                default: break;
+            }
+        }
+        if (!width_ || !height_) {
+            throw std::runtime_error("no size in y4m header " + file_->path());
+        }
+
+        // high bit depth like 420p10 takes 2 bytes a sample.
+        size_t p = colorspace.find('p');
+        size_t sample = p != std::string::npos && p + 1 < colorspace.size() && ::isdigit(colorspace[p + 1]) ? 2 : 1;
+        size_t luma = width_ * height_;
+        size_t chromaWidth = (width_ + 1) / 2;
+        if (colorspace.compare(0, 3, "420") == 0) {
+            frameSize_ = (luma + 2 * chromaWidth * ((height_ + 1) / 2)) * sample;
+        } else if (colorspace.compare(0, 3, "422") == 0) {
+            frameSize_ = (luma + 2 * chromaWidth * height_) * sample;
+        } else if (colorspace == "444alpha") {
+            frameSize_ = luma * 4;
+        } else if (colorspace.compare(0, 3, "444") == 0) {
+            frameSize_ = luma * 3 * sample;
+        } else if (colorspace.compare(0, 4, "mono") == 0) {
+            frameSize_ = luma * sample;
+        } else {
+            throw std::runtime_error("unsupported y4m colorspace " + colorspace);
+        }
+        y4m_ = true;
+        offset_ = end + 1 - data;
+    }
+
+    std::shared_ptr<MediaMappedFile> file_;
+    std::string bufferName_ = "frame";
+    size_t frameSize_ = 0;
+    size_t packetSize_ = 0;
+    bool y4m_ = false;
+    size_t width_ = 0;
+    size_t height_ = 0;
+    std::pair<size_t, size_t> frameRate_ = {0, 0};
+
+    size_t offset_ = 0;
+    size_t index_ = 0;
+    size_t readAhead_ = 8 << 20;
+    size_t advised_ = 0;
+    std::atomic<bool> interrupted_{false};
+};
+
+#endif  // MEDIA_FILE_H_
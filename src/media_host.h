@@ -0,0 +1,410 @@
+#ifndef MEDIA_HOST_H_
+#define MEDIA_HOST_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include "media_process.h"
+
+// a task is charged for its generator steps and for stage threads working on its elements, which
+// carry the task account, see BaseMediaElement::account. io threads of stages are not charged.
+struct MediaTaskQuota {
+    // cores, fraction allowed.
+    double cpu = 1.0;
+    // bytes of buffers created for the task, 0 for unlimited.
+    size_t memory = 0;
+};
+
+struct MediaTaskInfo {
+    std::string name;
+    MediaTaskQuota quota;
+    bool throttled;
+    // cores used in last window.
+    double cpuUsage;
+    int64_t memory;
+    // stages of the task runloop, read without pausing it.
+    std::vector<MediaStageSnapshot> stages;
+};
+
+// host many runloop tasks in one process, all generators are driven by a shared thread pool.
+class MediaTaskHost {
+ public:
+    MediaTaskHost(const size_t threadCount, const double cpuCapacity, const size_t memoryCapacity,
+                  const size_t windowMs = 100):
+        cpuCapacity_(cpuCapacity), memoryCapacity_(memoryCapacity), windowMs_(windowMs) {
+        loop_.setThreadCount(threadCount);
+        loop_.setKeepAlive(true);
+        // error in a task ends that task only.
+        loop_.setErrorHandler([](const std::exception &e) -> bool {
+            std::cerr << "task error: " << e.what() << std::endl;
+            return false;
+        });
+        loop_.setEndOfStreamHandler([this](size_t id) {
+            onTaskEnd_(id);
+        });
+        loop_.start();
+        running_ = true;
+        monitorThread_ = std::thread(&MediaTaskHost::monitor_, this);
+        reaperThread_ = std::thread(&MediaTaskHost::reaper_, this);
+    }
+
+    ~MediaTaskHost() {
+        shutdown();
+    }
+
+    // return false if host can not afford the quota.
+    bool start(const std::string &name, const std::shared_ptr<BaseMediaProcessRunloop> &runloop,
+               const MediaTaskQuota &quota = MediaTaskQuota()) {
+        std::shared_ptr<Task> task = std::make_shared<Task>();
+        task->name = name;
+        task->runloop = runloop;
+        task->quota = quota;
+        task->account = std::make_shared<MediaMemoryAccount>();
+        // weak, the task holds the runloop.
+        std::weak_ptr<Task> weak = task;
+        runloop->setReadyHandler([this, weak]() {
+            std::shared_ptr<Task> task = weak.lock();
+            if (task) {
+                onTaskReady_(task);
+            }
+        });
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!running_ || tasks_.find(name) != tasks_.end()) {
+                return false;
+            }
+
+            // admission control, reserved never exceeds capacity.
+            if (cpuReserved_ + quota.cpu > cpuCapacity_ ||
+                quota.memory > memoryCapacity_ - memoryReserved_) {
+                return false;
+            }
+            cpuReserved_ += quota.cpu;
+            memoryReserved_ += quota.memory;
+            tasks_[name] = task;
+
+            // register under lock, eos handler looks it up by id.
+            task->sourceId = loop_.addSource([this, task]() -> bool {
+                return step_(task);
+            });
+            sources_[task->sourceId] = task;
+        }
+        return true;
+    }
+
+    // stop a task and wait it leave the host.
+    void stop(const std::string &name) {
+        std::shared_ptr<Task> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto it = tasks_.find(name);
+            if (it == tasks_.end()) {
+                return;
+            }
+            task = it->second;
+            task->stopping = true;
+        }
+
+        task->runloop->interrupt();
+        // throttled task must be polled once to see stopping.
+        loop_.resume(task->sourceId);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (tasks_.find(name) != tasks_.end()) {
+            cond_.wait(lock);
+        }
+    }
+
+    // stop a task without losing elements, see BaseMediaProcessRunloop::shutdown, and wait it leave the
+    // host. return false if some were dropped at timeout.
+    bool drain(const std::string &name, const size_t timeoutMs = 5000) {
+        std::shared_ptr<Task> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto it = tasks_.find(name);
+            if (it == tasks_.end()) {
+                return true;
+            }
+            task = it->second;
+            task->draining = true;
+        }
+
+        // the step in progress ends, next one ends the task.
+        bool drained = task->runloop->shutdown(timeoutMs);
+        loop_.resume(task->sourceId);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (tasks_.find(name) != tasks_.end()) {
+            cond_.wait(lock);
+        }
+        return drained;
+    }
+
+    // with stages, snapshots are taken out of host lock so tasks keep being scheduled.
+    std::vector<MediaTaskInfo> list(const bool withStages = false) {
+        std::vector<MediaTaskInfo> infos;
+        std::vector<std::shared_ptr<Task> > tasks;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (auto &it : tasks_) {
+                MediaTaskInfo info;
+                info.name = it.first;
+                info.quota = it.second->quota;
+                info.throttled = it.second->throttled;
+                info.cpuUsage = it.second->cpuUsage;
+                info.memory = it.second->account->bytes();
+                infos.emplace_back(info);
+                tasks.emplace_back(it.second);
+            }
+        }
+        if (withStages) {
+            for (size_t i = 0; i < tasks.size(); ++i) {
+                infos[i].stages = tasks[i]->runloop->snapshot();
+            }
+        }
+        return infos;
+    }
+
+    // pools are shared by all tasks, one per buffer size.
+    std::shared_ptr<BaseMediaBufferPool> getBufferPool(const size_t &bufferSize) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::shared_ptr<BaseMediaBufferPool> &pool = pools_[bufferSize];
+        if (!pool) {
+            pool = std::make_shared<BaseMediaBufferPool>(bufferSize);
+        }
+        return pool;
+    }
+
+    std::vector<std::shared_ptr<BaseMediaBufferPool> > getBufferPools() {
+        std::vector<std::shared_ptr<BaseMediaBufferPool> > pools;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto &it : pools_) {
+            pools.emplace_back(it.second);
+        }
+        return pools;
+    }
+
+    // wait till no task in host.
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!tasks_.empty()) {
+            cond_.wait(lock);
+        }
+    }
+
+    // tasks are stopped at once, or drained within drainTimeoutMs each if it is not 0.
+    void shutdown(const size_t drainTimeoutMs = 0) {
+        std::vector<std::string> names;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!running_) {
+                return;
+            }
+            running_ = false;
+            for (auto &it : tasks_) {
+                names.emplace_back(it.first);
+            }
+            cond_.notify_all();
+        }
+
+        for (auto &name : names) {
+            if (drainTimeoutMs) {
+                drain(name, drainTimeoutMs);
+            } else {
+                stop(name);
+            }
+        }
+        // all tasks left, the reaper has none to end.
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            reaping_ = false;
+            cond_.notify_all();
+        }
+        if (reaperThread_.joinable()) {
+            reaperThread_.join();
+        }
+        loop_.stop();
+        if (monitorThread_.joinable()) {
+            monitorThread_.join();
+        }
+    }
+
+ private:
+    struct Task {
+        std::string name;
+        std::shared_ptr<BaseMediaProcessRunloop> runloop;
+        MediaTaskQuota quota;
+        std::shared_ptr<MediaMemoryAccount> account;
+        size_t sourceId = 0;
+        // paused till a source of its runloop is ready.
+        bool idle = false;
+        // ready handler calls, tells a step that found nothing ready whether it was woken meanwhile.
+        std::atomic<size_t> wakes{0};
+        // read by step_ without host lock.
+        std::atomic<bool> stopping{false};
+        // stages are finished by drain.
+        std::atomic<bool> draining{false};
+        bool throttled = false;
+        double cpuUsage = 0;
+    };
+
+    bool step_(const std::shared_ptr<Task> &task) {
+        if (task->stopping) {
+            return false;
+        }
+
+        size_t wakes = task->wakes.load();
+        MediaRunloopStep step;
+        {
+            // cpu time of the step is charged to the account with that of stage threads.
+            MediaMemoryAccountScope scope(task->account);
+            step = task->runloop->step();
+        }
+        if (step == MediaRunloopStepIdle) {
+            // sources paused or busy in other threads, not polled till one is ready.
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!task->stopping && task->wakes.load() == wakes) {
+                task->idle = true;
+                loop_.pause(task->sourceId);
+            }
+            return true;
+        }
+        bool more = step == MediaRunloopStepGenerated;
+
+        // over quota, leave it till next window.
+        if (more && overQuota_(task)) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!task->stopping) {
+                task->throttled = true;
+                loop_.pause(task->sourceId);
+            }
+        }
+        return more;
+    }
+
+    bool overQuota_(const std::shared_ptr<Task> &task) {
+        if (task->account->cpuNs() > static_cast<int64_t>(task->quota.cpu * windowMs_ * 1000000)) {
+            return true;
+        }
+        return task->quota.memory && task->account->bytes() > static_cast<int64_t>(task->quota.memory);
+    }
+
+    void onTaskReady_(const std::shared_ptr<Task> &task) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++task->wakes;
+        if (task->idle) {
+            task->idle = false;
+            if (!task->throttled) {
+                loop_.resume(task->sourceId);
+            }
+        }
+    }
+
+    // on a loop thread, the task is ended by the reaper so its stages do not hold a thread shared by
+    // all tasks while they drain.
+    void onTaskEnd_(const size_t &id) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = sources_.find(id);
+        if (it == sources_.end()) {
+            return;
+        }
+        ended_.emplace_back(it->second);
+        cond_.notify_all();
+    }
+
+    void reaper_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            while (reaping_ && ended_.empty()) {
+                cond_.wait(lock);
+            }
+            if (ended_.empty()) {
+                return;
+            }
+            std::shared_ptr<Task> task = ended_.front();
+            ended_.pop_front();
+            lock.unlock();
+            end_(task);
+            lock.lock();
+        }
+    }
+
+    void end_(std::shared_ptr<Task> task) {
+        // stages of a stopped task drop what is queued, those of one that ended by itself drain it. a
+        // drained task has finished them already.
+        if (!task->draining) {
+            task->runloop->shutdown(task->stopping ? 0 : kEndTimeoutMs);
+        }
+#ifdef MEDIA_ALLOC_PROFILE
+        // a task driven by step never ends a run of its runloop, which reports there, so per task here,
+        // before it leaves so the report is out when stop, drain or wait return.
+        std::cout << "task " << task->name << std::endl;
+        task->runloop->writeAllocReport(std::cout);
+#endif
+
+        // its generate holds the task too, the task is gone with the last map entry, before stop, drain
+        // or wait return.
+        size_t id = task->sourceId;
+        loop_.removeSource(id);
+        std::string name = task->name;
+        MediaTaskQuota quota = task->quota;
+        task.reset();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        sources_.erase(id);
+        tasks_.erase(name);
+        cpuReserved_ -= quota.cpu;
+        memoryReserved_ -= quota.memory;
+        cond_.notify_all();
+    }
+
+    void monitor_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (running_) {
+            cond_.wait_for(lock, std::chrono::milliseconds(windowMs_));
+
+            // new window
+            for (auto &it : tasks_) {
+                std::shared_ptr<Task> &task = it.second;
+                task->cpuUsage = task->account->takeCpuNs() / (windowMs_ * 1000000.0);
+                if (task->throttled && !overQuota_(task)) {
+                    task->throttled = false;
+                    if (!task->idle) {
+                        loop_.resume(task->sourceId);
+                    }
+                }
+            }
+        }
+    }
+
+    // stages of a task that ended by itself drain within this.
+    static const size_t kEndTimeoutMs = 5000;
+
+    double cpuCapacity_;
+    size_t memoryCapacity_;
+    size_t windowMs_;
+
+    double cpuReserved_ = 0;
+    size_t memoryReserved_ = 0;
+
+    bool running_ = false;
+    // cleared by shutdown once all tasks left.
+    bool reaping_ = true;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread monitorThread_;
+    std::thread reaperThread_;
+
+    std::map<std::string, std::shared_ptr<Task> > tasks_;
+    // ended by their source, waiting for the reaper.
+    std::deque<std::shared_ptr<Task> > ended_;
+    std::map<size_t, std::shared_ptr<Task> > sources_;
+    std::map<size_t, std::shared_ptr<BaseMediaBufferPool> > pools_;
+
+    // shared by all tasks
+    BaseMediaProcessRunloop loop_;
+};
+
+#endif  // MEDIA_HOST_H_
@@ -0,0 +1,715 @@
+#ifndef MEDIA_ISOLATE_H_
+#define MEDIA_ISOLATE_H_
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "media_config.h"
+#include "media_element.h"
+#include "media_mmap.h"
+#include "media_process.h"
+
+// element on a seqpacket unix socket, one message each, buffers as memfds in SCM_RIGHTS.
+//
+// message: header, table.
+// table:   per buffer    u32 name size, u32 0, u64 size, name, in order of passed fds,
+//          per metadata  u32 name size, u32 value size, name, value (as stored in element).
+
+struct MediaIsolateHeader {
+    uint32_t magic;
+    uint32_t metadataCount;
+    uint32_t bufferCount;
+    uint32_t tableSize;
+};
+
+static const uint32_t kMediaIsolateMagic = 0x4f53494d;
+
+struct MediaIsolateOptions {
+    // wait before a crashed child is started again.
+    size_t restartDelayMs = 100;
+    // child is killed if it has not exited this long after stop.
+    size_t stopTimeoutMs = 5000;
+    // metadata and buffer names of an element must fit.
+    size_t maxMessageBytes = 64 << 10;
+};
+
+enum MediaIsolateSend {
+    MediaIsolateSent = 0,
+    // socket full, only without blocking.
+    MediaIsolateBusy = 1,
+    // peer closed or died.
+    MediaIsolateFailed = 2,
+};
+
+// one end of the socket, both processes use it.
+class MediaIsolateChannel {
+ public:
+    enum {
+        kMaxBuffers = 64,
+    };
+
+    // an element packed once, so a send that would block can be tried again.
+    struct Message {
+        MediaIsolateHeader header;
+        std::string table;
+        std::vector<int> fds;
+        std::vector<std::shared_ptr<MediaMemfdBuffer> > held;
+    };
+
+    // buffers not in a memfd are copied into one, memfd buffers are passed as they are.
+    static Message pack(const std::shared_ptr<BaseMediaElement> &mediaElement) {
+        std::map<std::string, std::shared_ptr<BaseMediaBuffer> > buffers = mediaElement->getMediaBuffers();
+        std::map<std::string, std::string> metadata = mediaElement->getRawMetadata();
+        Message message;
+        std::vector<std::shared_ptr<MediaMemfdBuffer> > &held = message.held;
+        std::vector<int> &fds = message.fds;
+        std::string &table = message.table;
+        for (auto &it : buffers) {
+            if (!it.second) {
+                continue;
+            }
+            auto memfd = std::dynamic_pointer_cast<MediaMemfdBuffer>(it.second);
+            if (!memfd || !memfd->inMemfd()) {
+                memfd = MediaMemfdBuffer::create(it.second->size());
+                if (it.second->size()) {
+                    ::memcpy(memfd->data(), it.second->data(), it.second->size());
+                }
+                if (MediaStageStats::current()) {
+                    MediaStageStats::current()->recordBufferCopy(it.second->size());
+                }
+            }
+            held.emplace_back(memfd);
+            fds.push_back(memfd->fd());
+            append_(table, static_cast<uint32_t>(it.first.size()));
+            append_(table, static_cast<uint32_t>(0));
+            append_(table, static_cast<uint64_t>(memfd->size()));
+            table += it.first;
+        }
+        if (fds.size() > kMaxBuffers) {
+            throw std::runtime_error("too many buffers for isolated stage.");
+        }
+        for (auto &it : metadata) {
+            append_(table, static_cast<uint32_t>(it.first.size()));
+            append_(table, static_cast<uint32_t>(it.second.size()));
+            table += it.first;
+            table += it.second;
+        }
+
+        MediaIsolateHeader &header = message.header;
+        header.magic = kMediaIsolateMagic;
+        header.metadataCount = static_cast<uint32_t>(metadata.size());
+        header.bufferCount = static_cast<uint32_t>(fds.size());
+        header.tableSize = static_cast<uint32_t>(table.size());
+        return message;
+    }
+
+    static bool send(const int fd, const std::shared_ptr<BaseMediaElement> &mediaElement) {
+        return send(fd, pack(mediaElement), 0) == MediaIsolateSent;
+    }
+
+    // flags MSG_DONTWAIT for MediaIsolateBusy instead of blocking on a full socket.
+    static MediaIsolateSend send(const int fd, const Message &message, const int flags) {
+        MediaIsolateHeader header = message.header;
+        const std::vector<int> &fds = message.fds;
+        struct iovec iov[2] = {{&header, sizeof(header)},
+                               {const_cast<char *>(message.table.data()), message.table.size()}};
+
+        struct msghdr msg;
+        ::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxBuffers));
+        if (!fds.empty()) {
+            msg.msg_control = control.data();
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+            ::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+        }
+        while (true) {
+            if (::sendmsg(fd, &msg, MSG_NOSIGNAL | flags) >= 0) {
+                return MediaIsolateSent;
+            }
+            if (errno == EMSGSIZE) {
+                throw std::runtime_error("element too large for isolated stage message, raise maxMessageBytes.");
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return MediaIsolateBusy;
+            }
+            if (errno != EINTR) {
+                return MediaIsolateFailed;
+            }
+        }
+    }
+
+    // nullptr when peer closed or died.
+    static std::shared_ptr<BaseMediaElement> receive(const int fd, std::vector<char> &data) {
+        struct iovec iov = {data.data(), data.size()};
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxBuffers));
+        struct msghdr msg;
+        ::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+        ssize_t n;
+        do {
+            n = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+            return nullptr;
+        }
+
+        std::vector<int> fds;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                const int *p = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+                fds.insert(fds.end(), p, p + count);
+            }
+        }
+        // fds not adopted by a buffer are closed on error.
+        size_t adopted = 0;
+        try {
+            MediaIsolateHeader header;
+            if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || static_cast<size_t>(n) < sizeof(header)) {
+                throw std::runtime_error("bad isolated stage message.");
+            }
+            ::memcpy(&header, data.data(), sizeof(header));
+            if (header.magic != kMediaIsolateMagic || header.bufferCount != fds.size() ||
+                header.tableSize != static_cast<size_t>(n) - sizeof(header)) {
+                throw std::runtime_error("bad isolated stage message.");
+            }
+
+            auto me = std::make_shared<BaseMediaElement>();
+            const uint8_t *p = reinterpret_cast<const uint8_t *>(data.data()) + sizeof(header);
+            const uint8_t *end = p + header.tableSize;
+            while (adopted < header.bufferCount) {
+                uint32_t nameSize = read_<uint32_t>(p, end);
+                read_<uint32_t>(p, end);
+                uint64_t size = read_<uint64_t>(p, end);
+                std::string name = readString_(p, end, nameSize);
+                // adopt closes fd on failure too.
+                me->setMediaBuffer(name, MediaMemfdBuffer::adopt(fds[adopted++], size));
+            }
+            for (uint32_t i = 0; i < header.metadataCount; ++i) {
+                uint32_t nameSize = read_<uint32_t>(p, end);
+                uint32_t valueSize = read_<uint32_t>(p, end);
+                std::string name = readString_(p, end, nameSize);
+                me->setRawMetadata(name, readString_(p, end, valueSize));
+            }
+            return me;
+        } catch (...) {
+            for (size_t i = adopted; i < fds.size(); ++i) {
+                ::close(fds[i]);
+            }
+            throw;
+        }
+    }
+
+ private:
+    template <typename T>
+    static void append_(std::string &table, const T &value) {
+        table.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    static T read_(const uint8_t *&p, const uint8_t *end) {
+        if (end - p < static_cast<ptrdiff_t>(sizeof(T))) {
+            throw std::runtime_error("bad isolated stage table.");
+        }
+        T value;
+        ::memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+        return value;
+    }
+
+    static std::string readString_(const uint8_t *&p, const uint8_t *end, const size_t &size) {
+        if (static_cast<size_t>(end - p) < size) {
+            throw std::runtime_error("bad isolated stage table.");
+        }
+        std::string value(reinterpret_cast<const char *>(p), size);
+        p += size;
+        return value;
+    }
+};
+
+// forks the children of isolated stages. the server is multithreaded and a lock held by another thread
+// at fork stays locked in the child, so children are forked from this process instead, forked itself
+// before any thread starts. children build their stage from the stage registry as it was then, so
+// stage types and plugins are registered before start.
+class MediaIsolateZygote {
+ public:
+    static void start() {
+        MediaIsolateZygote &zygote = instance_();
+        std::unique_lock<std::mutex> lock(zygote.mutex_);
+        if (zygote.fd_ >= 0) {
+            return;
+        }
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+            throw std::runtime_error("can not create isolated stage zygote socket.");
+        }
+        pid_t parent = ::getpid();
+        pid_t pid = ::fork();
+        if (pid < 0) {
+            ::close(fds[0]);
+            ::close(fds[1]);
+            throw std::runtime_error("can not fork isolated stage zygote.");
+        }
+        if (pid == 0) {
+            ::close(fds[0]);
+            // zygote goes with the server.
+            ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+            if (::getppid() != parent) {
+                ::_exit(0);
+            }
+            // children are reaped by the kernel, the server sees them go by their socket.
+            ::signal(SIGCHLD, SIG_IGN);
+            loop_(fds[1]);
+            ::_exit(0);
+        }
+        ::close(fds[1]);
+        zygote.fd_ = fds[0];
+        zygote.pid_ = pid;
+    }
+
+    static bool running() {
+        MediaIsolateZygote &zygote = instance_();
+        std::unique_lock<std::mutex> lock(zygote.mutex_);
+        return zygote.fd_ >= 0;
+    }
+
+    // child serving stage type made with json params on fd, return its pid.
+    static pid_t spawn(const int fd, const std::string &type, const std::string &params,
+                       const size_t &maxMessageBytes) {
+        MediaIsolateZygote &zygote = instance_();
+        std::unique_lock<std::mutex> lock(zygote.mutex_);
+        if (zygote.fd_ < 0) {
+            throw std::runtime_error("isolated stages need MediaIsolateZygote::start() before threads start.");
+        }
+        Request request = {static_cast<uint32_t>(type.size()), static_cast<uint32_t>(params.size()),
+                           static_cast<uint64_t>(maxMessageBytes)};
+        struct iovec iov[3] = {{&request, sizeof(request)},
+                               {const_cast<char *>(type.data()), type.size()},
+                               {const_cast<char *>(params.data()), params.size()}};
+        char control[CMSG_SPACE(sizeof(int))];
+        ::memset(control, 0, sizeof(control));
+        struct msghdr msg;
+        ::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 3;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        ::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+        int32_t pid = -1;
+        if (::sendmsg(zygote.fd_, &msg, MSG_NOSIGNAL) < 0 ||
+            ::recv(zygote.fd_, &pid, sizeof(pid), 0) != sizeof(pid)) {
+            throw std::runtime_error("isolated stage zygote gone.");
+        }
+        if (pid <= 0) {
+            throw std::runtime_error("isolated stage zygote can not fork " + type + ".");
+        }
+        return pid;
+    }
+
+ private:
+    struct Request {
+        uint32_t typeSize;
+        uint32_t paramsSize;
+        uint64_t maxMessageBytes;
+    };
+
+    enum {
+        kMaxRequestBytes = 1 << 20,
+    };
+
+    static MediaIsolateZygote &instance_() {
+        static MediaIsolateZygote zygote;
+        return zygote;
+    }
+
+    // zygote: one child per request till the server closes.
+    static void loop_(const int control) {
+        std::vector<char> data(kMaxRequestBytes);
+        while (true) {
+            struct iovec iov = {data.data(), data.size()};
+            char cmsgData[CMSG_SPACE(sizeof(int))];
+            struct msghdr msg;
+            ::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = cmsgData;
+            msg.msg_controllen = sizeof(cmsgData);
+            ssize_t n = ::recvmsg(control, &msg, MSG_CMSG_CLOEXEC);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return;
+            }
+            int fd = -1;
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            if (cmsg && cmsg->cmsg_type == SCM_RIGHTS) {
+                ::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+            }
+            Request request;
+            ::memcpy(&request, data.data(), std::min(sizeof(request), static_cast<size_t>(n)));
+            int32_t pid = -1;
+            if (fd >= 0 && static_cast<size_t>(n) >= sizeof(request) &&
+                sizeof(request) + request.typeSize + request.paramsSize == static_cast<size_t>(n)) {
+                std::string type(data.data() + sizeof(request), request.typeSize);
+                std::string params(data.data() + sizeof(request) + request.typeSize, request.paramsSize);
+                pid = ::fork();
+                if (pid == 0) {
+                    ::close(control);
+                    ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+                    ::signal(SIGCHLD, SIG_DFL);
+                    try {
+                        serve_(fd, type, params, request.maxMessageBytes);
+                    } catch (const std::exception &e) {
+                        std::cerr << "isolated stage " << type << " failed: " << e.what() << std::endl;
+                        ::_exit(1);
+                    }
+                    ::_exit(0);
+                }
+            }
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            if (::send(control, &pid, sizeof(pid), MSG_NOSIGNAL) < 0) {
+                return;
+            }
+        }
+    }
+
+    // child: inputs from socket into the stage, its outputs back, till server closes.
+    static void serve_(const int fd, const std::string &type, const std::string &params,
+                       const size_t &maxMessageBytes) {
+        boost::property_tree::ptree tree;
+        std::istringstream is(params);
+        boost::property_tree::read_json(is, tree);
+        tree.put("type", type);
+        std::shared_ptr<BaseMediaProcess> mp = MediaPipelineConfig::createStage(MediaStageParams(tree));
+        if (mp->getInputCount() != 1 || mp->getOutputCount() != 1) {
+            throw std::runtime_error("isolated stage must be a pipe.");
+        }
+        // single threaded after fork, no other thread holds it.
+        std::mutex sendMutex;
+        mp->setOutputHandler(0, [fd, &sendMutex](std::shared_ptr<BaseMediaElement> me) {
+            std::unique_lock<std::mutex> lock(sendMutex);
+            if (!MediaIsolateChannel::send(fd, me)) {
+                ::_exit(0);
+            }
+        });
+        std::vector<char> data(sizeof(MediaIsolateHeader) + maxMessageBytes);
+        while (true) {
+            std::shared_ptr<BaseMediaElement> me;
+            try {
+                me = MediaIsolateChannel::receive(fd, data);
+                if (!me) {
+                    break;
+                }
+                mp->input(0, me);
+            } catch (const std::exception &e) {
+                std::cerr << "isolated stage error: " << e.what() << std::endl;
+            }
+        }
+        // stage threads finish what they hold.
+        mp->finish(MediaStageStats::Clock::time_point::max());
+        mp.reset();
+    }
+
+    std::mutex mutex_;
+    int fd_ = -1;
+    pid_t pid_ = -1;
+};
+
+// runs a pipe stage in a child process, so a crash in it does not take the server down. the stage is
+// made from the registry by type and params as a pipeline config stage is, in a child of the zygote.
+// elements go to the child and back over a unix socket, buffers shared as memfds, not copied if they
+// are already in one, see acquire. a child that dies is started again, elements it held are lost
+// unnoticed, those sent till it is back are counted in lost.
+//
+// made from config as {"type": "isolated", "stage": {...}}, see create.
+class MediaIsolatedPipe: public BaseMediaProcessPipe {
+ public:
+    MediaIsolatedPipe(const std::string &type, const MediaStageParams &params = MediaStageParams(),
+                      const MediaIsolateOptions &options = MediaIsolateOptions()):
+        type_(type), options_(options) {
+        std::ostringstream os;
+        boost::property_tree::write_json(os, params.tree(), false);
+        params_ = os.str();
+    }
+
+    ~MediaIsolatedPipe() {
+        stop(true);
+        wait();
+    }
+
+    virtual const size_t getInputCount() const {
+        return 1;
+    }
+
+    virtual const size_t getOutputCount() const {
+        return 1;
+    }
+
+    // factory of the "isolated" stage type, inner stage from params "stage", started.
+    static std::shared_ptr<BaseMediaProcess> create(const MediaStageParams &params) {
+        MediaStageParams stage(params.tree().get_child("stage"));
+        auto pipe = std::make_shared<MediaIsolatedPipe>(stage.get<std::string>("type"), stage);
+        pipe->start();
+        return pipe;
+    }
+
+    // buffer that crosses to the child without copy.
+    static std::shared_ptr<BaseMediaBuffer> acquire(const size_t &size) {
+        return MediaMemfdBuffer::create(size);
+    }
+
+    // waits out a full socket without lock, so stop can still kill a child that hangs.
+    virtual void input(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
+        MediaIsolateChannel::Message message = MediaIsolateChannel::pack(mediaElement);
+        std::unique_lock<MediaMutex> lock(mutex_);
+        if (!running_) {
+            throw std::runtime_error("isolated stage not running.");
+        }
+        while (true) {
+            MediaIsolateSend sent = MediaIsolateChannel::send(fd_, message, MSG_DONTWAIT);
+            if (sent == MediaIsolateSent) {
+                return;
+            }
+            if (sent == MediaIsolateFailed) {
+                // reader sees the child gone and restarts it, the pipeline goes on.
+                ++lost_;
+                return;
+            }
+            struct pollfd pfd = {fd_, POLLOUT, 0};
+            lock.unlock();
+            ::poll(&pfd, 1, 100);
+            lock.lock();
+            if (!running_) {
+                ++lost_;
+                return;
+            }
+        }
+    }
+
+    virtual void start() {
+        stop(true);
+        wait();
+        std::unique_lock<MediaMutex> lock(mutex_);
+        spawn_();
+        running_ = true;
+        stopping_ = false;
+        reader_ = std::thread(&MediaIsolatedPipe::readLoop_, this);
+    }
+
+    // the child finishes elements it has, bounded by the deadline and stopTimeoutMs of options. return
+    // false if it was killed.
+    virtual bool finish(const MediaStageStats::Clock::time_point &deadline) {
+        int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - MediaStageStats::Clock::now()).count();
+        stop(true);
+        return wait_(static_cast<size_t>(std::max<int64_t>(std::min<int64_t>(ms, options_.stopTimeoutMs), 0)));
+    }
+
+    // graceful lets the child finish elements it has, else it is killed.
+    virtual void stop(bool graceful = true) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+        stopping_ = true;
+        if (graceful) {
+            ::shutdown(fd_, SHUT_WR);
+        } else if (pid_ > 0) {
+            ::kill(pid_, SIGKILL);
+        }
+    }
+
+    virtual void wait() {
+        wait_(options_.stopTimeoutMs);
+    }
+
+    // times the child was started again after it died.
+    const size_t restarts() const {
+        return restarts_.load();
+    }
+
+    // elements sent while the child was gone, or still waiting to be sent at stop.
+    const size_t lost() const {
+        return lost_.load();
+    }
+
+    const pid_t childPid() {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        return pid_;
+    }
+
+ private:
+    // lock held.
+    void spawn_() {
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+            throw std::runtime_error("can not create isolated stage socket.");
+        }
+        pid_t pid;
+        try {
+            pid = MediaIsolateZygote::spawn(fds[1], type_, params_, options_.maxMessageBytes);
+        } catch (...) {
+            ::close(fds[0]);
+            ::close(fds[1]);
+            throw;
+        }
+        ::close(fds[1]);
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        fd_ = fds[0];
+        pid_ = pid;
+    }
+
+    // return false if the child was killed.
+    bool wait_(const size_t &timeoutMs) {
+        pid_t pid;
+        bool report;
+        {
+            std::unique_lock<MediaMutex> lock(mutex_);
+            pid = pid_;
+            report = !stopping_;
+        }
+        // a child that does not exit in time is killed, which ends the reader too.
+        bool exited = reap_(pid, timeoutMs, report);
+        if (reader_.joinable()) {
+            reader_.join();
+        }
+        std::unique_lock<MediaMutex> lock(mutex_);
+        if (pid_ == pid) {
+            pid_ = -1;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        return exited;
+    }
+
+    // wait child exit up to timeoutMs, then kill it. the zygote reaps it, it is gone once signal 0
+    // finds no such process. called without lock, so input is not held meanwhile. return false if it
+    // was killed.
+    static bool reap_(const pid_t pid, const size_t &timeoutMs, const bool report) {
+        if (pid <= 0) {
+            return true;
+        }
+        bool exited = true;
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() +
+                                                    std::chrono::milliseconds(timeoutMs);
+        while (::kill(pid, 0) == 0) {
+            if (std::chrono::steady_clock::now() >= end) {
+                if (report) {
+                    std::cerr << "isolated stage child " << pid << " hung up, killed." << std::endl;
+                }
+                ::kill(pid, SIGKILL);
+                end = std::chrono::steady_clock::time_point::max();
+                exited = false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return exited;
+    }
+
+    // outputs of the child, restart it when it is gone.
+    void readLoop_() {
+        std::vector<char> data(sizeof(MediaIsolateHeader) + options_.maxMessageBytes);
+        int fd;
+        {
+            std::unique_lock<MediaMutex> lock(mutex_);
+            fd = fd_;
+        }
+        while (true) {
+            std::shared_ptr<BaseMediaElement> me;
+            try {
+                me = MediaIsolateChannel::receive(fd, data);
+            } catch (const std::exception &e) {
+                if (!errorHandler_ || !errorHandler_(e)) {
+                    std::cerr << "isolated stage error: " << e.what() << std::endl;
+                }
+                continue;
+            }
+            if (me) {
+                outputHandlers_[0](me);
+                continue;
+            }
+
+            std::unique_lock<MediaMutex> lock(mutex_);
+            if (stopping_) {
+                return;
+            }
+            // crashed, not asked to stop. input meanwhile fails on the old socket and counts as lost.
+            pid_t pid = pid_;
+            std::cerr << "isolated stage child " << pid << " of " << type_ << " gone, starting again." << std::endl;
+            lock.unlock();
+            // it is exiting, give it the time a stop would.
+            reap_(pid, options_.stopTimeoutMs, true);
+            std::this_thread::sleep_for(std::chrono::milliseconds(options_.restartDelayMs));
+            lock.lock();
+            if (stopping_) {
+                return;
+            }
+            try {
+                spawn_();
+            } catch (const std::exception &e) {
+                std::cerr << e.what() << std::endl;
+                running_ = false;
+                stopping_ = true;
+                return;
+            }
+            fd = fd_;
+            ++restarts_;
+        }
+    }
+
+    std::string type_;
+    // json
+    std::string params_;
+    MediaIsolateOptions options_;
+
+    MediaMutex mutex_ MEDIA_LOCK_SITE("MediaIsolatedPipe::mutex_");
+    int fd_ = -1;
+    pid_t pid_ = -1;
+    bool running_ = false;
+    bool stopping_ = false;
+    std::thread reader_;
+    std::atomic<size_t> restarts_{0};
+    std::atomic<size_t> lost_{0};
+};
+
+#endif  // MEDIA_ISOLATE_H_
@@ -0,0 +1,185 @@
+#ifndef MEDIA_LOCK_H_
+#define MEDIA_LOCK_H_
+
+#include <mutex>
+#include <condition_variable>
+#include "boost/thread.hpp"
+
+// framework locks, built with MEDIA_LOCK_PROFILE they record acquisitions, wait and hold time per site.
+
+#ifdef MEDIA_LOCK_PROFILE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// one lock member of a class, shared by all its instances.
+struct MediaLockSite {
+    std::string name;
+    std::atomic<uint64_t> acquisitions{0};
+    std::atomic<uint64_t> contended{0};
+    std::atomic<uint64_t> waitNs{0};
+    std::atomic<uint64_t> holdNs{0};
+    std::atomic<uint64_t> maxWaitNs{0};
+    std::atomic<uint64_t> maxHoldNs{0};
+};
+
+class MediaLockProfile {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    static MediaLockSite *site(const std::string &name) {
+        MediaLockProfile &profile = instance_();
+        std::unique_lock<std::mutex> lock(profile.mutex_);
+        std::unique_ptr<MediaLockSite> &site = profile.sites_[name];
+        if (!site) {
+            site.reset(new MediaLockSite());
+            site->name = name;
+        }
+        return site.get();
+    }
+
+    static uint64_t since(const Clock::time_point &begin) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+    }
+
+    static void max(std::atomic<uint64_t> &v, const uint64_t &n) {
+        uint64_t curr = v.load(std::memory_order_relaxed);
+        while (n > curr && !v.compare_exchange_weak(curr, n, std::memory_order_relaxed)) {
+        }
+    }
+
+    // sites by total wait time, the top one limits scaling.
+    static void write(std::ostream &os) {
+        MediaLockProfile &profile = instance_();
+        std::vector<MediaLockSite *> sites;
+        {
+            std::unique_lock<std::mutex> lock(profile.mutex_);
+            for (auto &it : profile.sites_) {
+                sites.emplace_back(it.second.get());
+            }
+        }
+        std::sort(sites.begin(), sites.end(), [](MediaLockSite *a, MediaLockSite *b) {
+            return a->waitNs.load() > b->waitNs.load();
+        });
+
+        os << "site\tacquisitions\tcontended\twait-ns\tmax-wait-ns\thold-ns\tmax-hold-ns" << std::endl;
+        for (auto site : sites) {
+            os << site->name << "\t" << site->acquisitions << "\t" << site->contended << "\t" << site->waitNs
+               << "\t" << site->maxWaitNs << "\t" << site->holdNs << "\t" << site->maxHoldNs << std::endl;
+        }
+    }
+
+ private:
+    static MediaLockProfile &instance_() {
+        static MediaLockProfile profile;
+        return profile;
+    }
+
+    std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<MediaLockSite> > sites_;
+};
+
+// wraps a mutex, lock tries first so uncontended acquisition does not read the clock twice.
+template <typename Mutex>
+class MediaProfiledMutex {
+ public:
+    explicit MediaProfiledMutex(MediaLockSite *site): site_(site) {}
+
+    void lock() {
+        if (!mutex_.try_lock()) {
+            MediaLockProfile::Clock::time_point begin = MediaLockProfile::Clock::now();
+            mutex_.lock();
+            uint64_t ns = MediaLockProfile::since(begin);
+            ++site_->contended;
+            site_->waitNs += ns;
+            MediaLockProfile::max(site_->maxWaitNs, ns);
+        }
+        ++site_->acquisitions;
+        held_ = MediaLockProfile::Clock::now();
+    }
+
+    bool try_lock() {
+        if (!mutex_.try_lock()) {
+            return false;
+        }
+        ++site_->acquisitions;
+        held_ = MediaLockProfile::Clock::now();
+        return true;
+    }
+
+    void unlock() {
+        uint64_t ns = MediaLockProfile::since(held_);
+        mutex_.unlock();
+        site_->holdNs += ns;
+        MediaLockProfile::max(site_->maxHoldNs, ns);
+    }
+
+    // shared lock, for shared mutex only. hold time kept per thread as several threads hold it.
+    void lock_shared() {
+        if (!mutex_.try_lock_shared()) {
+            MediaLockProfile::Clock::time_point begin = MediaLockProfile::Clock::now();
+            mutex_.lock_shared();
+            uint64_t ns = MediaLockProfile::since(begin);
+            ++site_->contended;
+            site_->waitNs += ns;
+            MediaLockProfile::max(site_->maxWaitNs, ns);
+        }
+        ++site_->acquisitions;
+        sharedHeld_()[this] = MediaLockProfile::Clock::now();
+    }
+
+    void unlock_shared() {
+        std::unordered_map<const void *, MediaLockProfile::Clock::time_point> &held = sharedHeld_();
+        auto it = held.find(this);
+        uint64_t ns = it != held.end() ? MediaLockProfile::since(it->second) : 0;
+        if (it != held.end()) {
+            held.erase(it);
+        }
+        mutex_.unlock_shared();
+        site_->holdNs += ns;
+        MediaLockProfile::max(site_->maxHoldNs, ns);
+    }
+
+ private:
+    static std::unordered_map<const void *, MediaLockProfile::Clock::time_point> &sharedHeld_() {
+        static thread_local std::unordered_map<const void *, MediaLockProfile::Clock::time_point> held;
+        return held;
+    }
+
+    Mutex mutex_;
+    MediaLockSite *site_;
+    MediaLockProfile::Clock::time_point held_;
+};
+
+// site looked up once per member, not per instance.
+#define MEDIA_LOCK_SITE(name) {[]() -> MediaLockSite * { \
+        static MediaLockSite *site = MediaLockProfile::site(name); \
+        return site; \
+    }()}
+
+using MediaMutex = MediaProfiledMutex<std::mutex>;
+using MediaCondition = std::condition_variable_any;
+using MediaBoostMutex = MediaProfiledMutex<boost::mutex>;
+using MediaBoostCondition = boost::condition_variable_any;
+using MediaSharedMutex = MediaProfiledMutex<boost::shared_mutex>;
+
+#else
+
+#define MEDIA_LOCK_SITE(name)
+
+using MediaMutex = std::mutex;
+using MediaCondition = std::condition_variable;
+using MediaBoostMutex = boost::mutex;
+using MediaBoostCondition = boost::condition_variable;
+using MediaSharedMutex = boost::shared_mutex;
+
+#endif  // MEDIA_LOCK_PROFILE
+
+#endif  // MEDIA_LOCK_H_
@@ -1,20 +1,49 @@
 #include <string>
+#include <cerrno>
+#include <cstdlib>
 #include <iostream>
 #include <chrono>
 #include <memory>
 #include <fstream>
+#include <csignal>
+#include <unistd.h>
 #include "media_element.h"
 #include "media_process.h"
+#include "media_host.h"
+#include "media_metrics.h"
+#include "media_alloc.h"
 #include "media_task.h"
+#include "media_config.h"
+#include "media_plugin.h"
+#include "media_isolate.h"
+#include "media_trace.h"
 #include "boost/filesystem.hpp"
 
 using namespace std;
 using namespace boost::filesystem;
 
 void usage(const char *cmd) {
-	std::cout << "usage: " << cmd << " image-file-path" << std::endl;
+	std::cout << "usage: " << cmd << " image-file-path"
+		<< " [--metrics-port port] [--metrics-socket path] [--metrics-file path] [--control-socket path] [--trace path]"
+		<< " [--memory bytes] [--task-memory bytes] [--pipeline config-file]... [--plugin file-or-directory]..."
+		<< std::endl;
 }
 
+// false if value is not a whole number of bytes.
+bool parseBytes(const char *value, size_t &bytes) {
+	char *end = nullptr;
+	errno = 0;
+	unsigned long long parsed = std::strtoull(value, &end, 10);
+	if (errno || end == value || *end || *value == '-') {
+		return false;
+	}
+	bytes = static_cast<size_t>(parsed);
+	return true;
+}
+
+// memory quota of a task whose config has none.
+static const size_t kTaskMemory = size_t(1) << 30;
+
 class MPProductor: public BaseMediaProcessGenerator {
 public:
 	MPProductor() {}
@@ -67,12 +96,172 @@ public:
 
 int main(int argc, char const *argv[]) {
 	std::cout << "hello media process!" << std::endl;
-	if (argc != 2) {
+	if (argc < 2 || argc % 2 != 0) {
         usage(argv[0]);
         std::exit(1);
     }
     string path = argv[1];
-	Task001 t1(path);
-	t1.run();
+
+	// -1 for no tcp listener.
+	long metricsPort = -1;
+	string metricsSocket;
+	string metricsFile;
+	string controlSocket;
+	string trace;
+	// 0 for physical memory.
+	size_t memory = 0;
+	size_t taskMemory = kTaskMemory;
+	std::vector<string> pipelines;
+	std::vector<string> plugins;
+	for (int i = 2; i + 1 < argc; i += 2) {
+		string option = argv[i];
+		if (option == "--metrics-port") {
+			char *end = nullptr;
+			errno = 0;
+			metricsPort = std::strtol(argv[i + 1], &end, 10);
+			if (errno || end == argv[i + 1] || *end || metricsPort < 0 || metricsPort > 65535) {
+				std::cout << "bad --metrics-port " << argv[i + 1] << ", expect 0 to 65535." << std::endl;
+				usage(argv[0]);
+				return 1;
+			}
+		} else if (option == "--metrics-socket") {
+			metricsSocket = argv[i + 1];
+		} else if (option == "--metrics-file") {
+			metricsFile = argv[i + 1];
+		} else if (option == "--control-socket") {
+			controlSocket = argv[i + 1];
+		} else if (option == "--trace") {
+			trace = argv[i + 1];
+		} else if (option == "--memory" || option == "--task-memory") {
+			if (!parseBytes(argv[i + 1], option == "--memory" ? memory : taskMemory)) {
+				std::cout << "bad " << option << " " << argv[i + 1] << ", expect bytes." << std::endl;
+				usage(argv[0]);
+				return 1;
+			}
+		} else if (option == "--pipeline") {
+			pipelines.emplace_back(argv[i + 1]);
+		} else if (option == "--plugin") {
+			plugins.emplace_back(argv[i + 1]);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// stages a pipeline config may name.
+	MediaStageRegistry::instance().add<MPProductor>("MPProductor");
+	MediaStageRegistry::instance().add<MPShow>("MPShow");
+	// {"type": "isolated", "stage": {...}} runs the inner stage in a child process.
+	MediaStageRegistry::instance().add("isolated", MediaIsolatedPipe::create);
+	MediaPluginLoader loader;
+	try {
+		for (auto &plugin : plugins) {
+			std::vector<MediaPluginLoaded> loaded;
+			if (is_directory(plugin)) {
+				loaded = loader.loadDirectory(plugin);
+			} else {
+				loaded.emplace_back(loader.load(plugin));
+			}
+			for (auto &p : loaded) {
+				std::cout << "plugin " << p.name << " " << p.version << " (" << p.isa << ") from " << p.path << std::endl;
+			}
+		}
+		// forks children of isolated stages, before any thread starts and after every stage type is known.
+		MediaIsolateZygote::start();
+	} catch (const std::exception &e) {
+		std::cout << e.what() << std::endl;
+		return 1;
+	}
+
+	// these drain the tasks and end the server, taken by sigwait, blocked before any thread starts so
+	// every thread inherits it.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	// stage slices of elements, written when the server ends.
+	if (!trace.empty()) {
+		MediaTracer::instance().enable();
+	}
+
+	// tasks share the host threads, admission by cpu cores and buffer memory, each task takes one core
+	// and taskMemory unless its config says otherwise.
+	size_t cores = std::max(1u, std::thread::hardware_concurrency());
+	if (!memory) {
+		memory = static_cast<size_t>(sysconf(_SC_PHYS_PAGES)) * static_cast<size_t>(sysconf(_SC_PAGE_SIZE));
+	}
+	MediaTaskHost host(cores, cores, memory);
+	MediaTaskQuota quota;
+	quota.memory = std::min(taskMemory, memory);
+
+	// metrics are optional, for the monitoring scraper. stage stats are only recorded for them.
+	MediaMetricsExporter exporter(host);
+	exporter.setDefaultQuota(quota);
+	if (metricsPort >= 0 || !metricsSocket.empty() || !metricsFile.empty() || !controlSocket.empty()) {
+		MediaStageStats::enabled() = true;
+	}
+	if (metricsPort >= 0) {
+		if (!exporter.listenTcp(static_cast<uint16_t>(metricsPort))) {
+			std::cout << "metrics --metrics-port " << metricsPort << " failed." << std::endl;
+			return 1;
+		}
+		// port 0 takes a free one, the scraper needs to know which.
+		std::cout << "metrics on 127.0.0.1:" << exporter.tcpPort() << std::endl;
+	}
+	if (!metricsSocket.empty() && !exporter.listenUnix(metricsSocket)) {
+		std::cout << "metrics --metrics-socket " << metricsSocket << " failed." << std::endl;
+		return 1;
+	}
+	// tasks are started, stopped and listed over it, see MediaMetricsExporter::control_.
+	if (!controlSocket.empty() && !exporter.listenUnix(controlSocket, true)) {
+		std::cout << "control --control-socket " << controlSocket << " failed." << std::endl;
+		return 1;
+	}
+	if (!metricsFile.empty()) {
+		exporter.dumpEvery(metricsFile, 10000);
+	}
+
+	if (pipelines.empty() && controlSocket.empty()) {
+		if (!host.start("task001", std::make_shared<Task001>(path), quota)) {
+			std::cout << "host saturated, task rejected." << std::endl;
+			return 1;
+		}
+	}
+	for (auto &pipeline : pipelines) {
+		try {
+			MediaPipelineConfig config = MediaPipelineConfig::load(pipeline);
+			std::shared_ptr<BaseMediaProcessRunloop> runloop = config.build();
+			if (!host.start(config.name(), runloop, config.quota(quota))) {
+				runloop->shutdown(0);
+				std::cout << "task " << config.name() << " of " << pipeline
+					<< " exists or host saturated, task rejected." << std::endl;
+				return 1;
+			}
+		} catch (const std::exception &e) {
+			std::cout << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	// till tasks all ended, or with a control socket till a signal.
+	while (true) {
+		struct timespec wait = {0, 200 * 1000000};
+		int signal = sigtimedwait(&signals, nullptr, &wait);
+		if (signal > 0) {
+			std::cout << "signal " << signal << ", draining tasks." << std::endl;
+			break;
+		}
+		if (controlSocket.empty() && host.list().empty()) {
+			break;
+		}
+	}
+	exporter.stop();
+	host.shutdown(5000);
+	if (!trace.empty() && !MediaTracer::instance().write(trace)) {
+		std::cout << "trace --trace " << trace << " failed." << std::endl;
+		return 1;
+	}
 	return 0;
 }
@@ -0,0 +1,437 @@
+#ifndef MEDIA_METRICS_H_
+#define MEDIA_METRICS_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <cctype>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "media_config.h"
+#include "media_host.h"
+
+// host metrics in prometheus text format, served over loopback http or a unix socket, or dumped to a file.
+// counters are read from per thread shards and queue gauges under a short lock, scrapes do not pause pipelines.
+// a unix socket may also control the tasks of the host, see control_.
+class MediaMetricsExporter {
+ public:
+    explicit MediaMetricsExporter(MediaTaskHost &host): host_(host) {}
+
+    ~MediaMetricsExporter() {
+        stop();
+    }
+
+    // bound to 127.0.0.1 only, port 0 for any free one, see tcpPort.
+    bool listenTcp(const uint16_t port) {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return false;
+        }
+        int on = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t size = sizeof(addr);
+        if (::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(fd, 16) < 0 ||
+            ::getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &size) < 0) {
+            ::close(fd);
+            return false;
+        }
+        tcpPort_ = ntohs(addr.sin_port);
+        serve_(fd, false);
+        return true;
+    }
+
+    // http over unix socket, e.g. curl --unix-socket path http://localhost/metrics. with control, anyone
+    // who can connect to path can start and stop tasks.
+    bool listenUnix(const std::string &path, const bool control = false) {
+        struct sockaddr_un addr = {};
+        if (path.size() >= sizeof(addr.sun_path)) {
+            return false;
+        }
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return false;
+        }
+        addr.sun_family = AF_UNIX;
+        path.copy(addr.sun_path, path.size());
+        ::unlink(path.c_str());
+        if (::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(fd, 16) < 0) {
+            ::close(fd);
+            return false;
+        }
+        serve_(fd, control);
+        return true;
+    }
+
+    // port bound by listenTcp, 0 before.
+    const uint16_t tcpPort() const {
+        return tcpPort_;
+    }
+
+    // quota of tasks started over control whose config has none, set before listen.
+    void setDefaultQuota(const MediaTaskQuota &quota) {
+        defaultQuota_ = quota;
+    }
+
+    // written to a temporary file then renamed, so readers never see a partial file.
+    bool dump(const std::string &path) {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp.c_str());
+            if (!out) {
+                return false;
+            }
+            write(out);
+            if (!out.good()) {
+                return false;
+            }
+        }
+        return std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    // dump every interval till stop, and once more at stop.
+    void dumpEvery(const std::string &path, const size_t intervalMs) {
+        running_ = true;
+        threads_.emplace_back([this, path, intervalMs]() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (running_) {
+                cond_.wait_for(lock, std::chrono::milliseconds(intervalMs));
+                lock.unlock();
+                dump(path);
+                lock.lock();
+            }
+        });
+    }
+
+    void stop() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            running_ = false;
+            cond_.notify_all();
+        }
+        for (auto &t : threads_) {
+            if (t.joinable()) {
+                t.join();
+            }
+        }
+        threads_.clear();
+    }
+
+    void write(std::ostream &os) {
+        std::vector<MediaTaskInfo> tasks = host_.list(true);
+        std::vector<std::shared_ptr<BaseMediaBufferPool> > pools = host_.getBufferPools();
+
+        family_(os, "mp_tasks", "gauge", "tasks running in host");
+        os << "mp_tasks " << tasks.size() << "\n";
+
+        taskFamily_(os, tasks, "mp_task_cpu_usage_cores", "cores used in last window",
+                    [](const MediaTaskInfo &t) { return t.cpuUsage; });
+        taskFamily_(os, tasks, "mp_task_cpu_quota_cores", "cores allowed",
+                    [](const MediaTaskInfo &t) { return t.quota.cpu; });
+        taskFamily_(os, tasks, "mp_task_memory_bytes", "bytes of buffers held by task",
+                    [](const MediaTaskInfo &t) { return static_cast<double>(t.memory); });
+        taskFamily_(os, tasks, "mp_task_memory_quota_bytes", "bytes of buffers allowed, 0 for unlimited",
+                    [](const MediaTaskInfo &t) { return static_cast<double>(t.quota.memory); });
+        taskFamily_(os, tasks, "mp_task_throttled", "1 if task is paused by its quota",
+                    [](const MediaTaskInfo &t) { return t.throttled ? 1.0 : 0.0; });
+
+        typedef std::function<double(const MediaStageSnapshot &)> StageValue;
+        struct StageMetric {
+            const char *name;
+            const char *type;
+            const char *help;
+            bool queue;
+            StageValue value;
+        };
+        const StageMetric metrics[] = {
+            {"mp_stage_elements_total", "counter", "elements into stage", false,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.counters.elements); }},
+            {"mp_stage_bytes_total", "counter", "buffer bytes of elements into stage", false,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.counters.bytes); }},
+            {"mp_stage_heap_allocations_total", "counter", "heap allocations, needs MEDIA_ALLOC_PROFILE", false,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.counters.heapAllocs); }},
+            {"mp_stage_heap_bytes_total", "counter", "heap bytes allocated, needs MEDIA_ALLOC_PROFILE", false,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.counters.heapBytes); }},
+            {"mp_stage_buffer_allocations_total", "counter", "media buffers allocated", false,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.counters.bufferAllocs); }},
+            {"mp_stage_buffer_bytes_total", "counter", "media buffer bytes allocated", false,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.counters.bufferBytes); }},
+            {"mp_stage_buffer_copied_bytes_total", "counter", "media buffer bytes copied", false,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.counters.bufferCopiedBytes); }},
+            {"mp_stage_elements_created_total", "counter", "elements created", false,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.counters.elementsCreated); }},
+            {"mp_stage_queue_depth", "gauge", "elements waiting in stage queue", true,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.queue.depth); }},
+            {"mp_stage_queue_peak_depth", "gauge", "peak of queue depth since start", true,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.queue.peakDepth); }},
+            {"mp_stage_queue_average_depth", "gauge", "time weighted queue depth since start", true,
+             [](const MediaStageSnapshot &s) { return s.queue.averageDepth; }},
+            {"mp_stage_input_blocked_seconds_total", "counter", "time producers blocked in input", true,
+             [](const MediaStageSnapshot &s) { return s.queue.inputBlockedNs / 1e9; }},
+            {"mp_stage_idle_seconds_total", "counter", "time workers waited for input", true,
+             [](const MediaStageSnapshot &s) { return s.queue.idleNs / 1e9; }},
+            {"mp_stage_queue_high_level_total", "counter", "times queue reached high level", true,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.queue.highLevelCount); }},
+            {"mp_stage_workers", "gauge", "worker threads, or elements in flight on a shared executor", true,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.queue.workers); }},
+            {"mp_stage_deadline_misses_total", "counter", "elements dropped for their deadline passed", true,
+             [](const MediaStageSnapshot &s) { return static_cast<double>(s.queue.deadlineMisses); }},
+        };
+        for (auto &m : metrics) {
+            family_(os, m.name, m.type, m.help);
+            for (auto &t : tasks) {
+                for (auto &s : t.stages) {
+                    if (!m.queue || s.hasQueue) {
+                        os << m.name << "{" << stageLabels_(t, s) << "} " << m.value(s) << "\n";
+                    }
+                }
+            }
+        }
+
+        summary_(os, tasks, "mp_stage_process_seconds", "self time in input, generate or process",
+                 [](const MediaStageSnapshot &s) -> const MediaHistogram & { return s.counters.process; });
+        summary_(os, tasks, "mp_stage_inclusive_seconds", "time in input, generate or process with stages it called",
+                 [](const MediaStageSnapshot &s) -> const MediaHistogram & { return s.counters.inclusive; });
+        summary_(os, tasks, "mp_stage_wait_seconds", "time elements waited in stage queue",
+                 [](const MediaStageSnapshot &s) -> const MediaHistogram & { return s.counters.wait; });
+
+        family_(os, "mp_pool_free_buffers", "gauge", "buffers kept for reuse");
+        for (auto &p : pools) {
+            os << "mp_pool_free_buffers{buffer_size=\"" << p->bufferSize() << "\"} " << p->freeCount() << "\n";
+        }
+        family_(os, "mp_pool_acquires_total", "counter", "buffers acquired");
+        for (auto &p : pools) {
+            os << "mp_pool_acquires_total{buffer_size=\"" << p->bufferSize() << "\"} " << p->acquireCount() << "\n";
+        }
+        family_(os, "mp_pool_reuses_total", "counter", "buffers acquired without allocation");
+        for (auto &p : pools) {
+            os << "mp_pool_reuses_total{buffer_size=\"" << p->bufferSize() << "\"} " << p->reuseCount() << "\n";
+        }
+    }
+
+ private:
+    static void family_(std::ostream &os, const char *name, const char *type, const char *help) {
+        os << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+    }
+
+    static std::string escape_(const std::string &value) {
+        std::string escaped;
+        for (auto c : value) {
+            if (c == '\n') {
+                escaped += "\\n";
+                continue;
+            }
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    static std::string stageLabels_(const MediaTaskInfo &task, const MediaStageSnapshot &stage) {
+        return "task=\"" + escape_(task.name) + "\",stage=\"" + escape_(stage.name) + "\"";
+    }
+
+    static void taskFamily_(std::ostream &os, const std::vector<MediaTaskInfo> &tasks, const char *name,
+                            const char *help, const std::function<double(const MediaTaskInfo &)> &value) {
+        family_(os, name, "gauge", help);
+        for (auto &t : tasks) {
+            os << name << "{task=\"" << escape_(t.name) << "\"} " << value(t) << "\n";
+        }
+    }
+
+    // histograms as summaries, 496 buckets per stage is too many series.
+    static void summary_(std::ostream &os, const std::vector<MediaTaskInfo> &tasks, const char *name,
+                         const char *help,
+                         const std::function<const MediaHistogram &(const MediaStageSnapshot &)> &histogram) {
+        static const char *quantiles[] = {"0.5", "0.9", "0.99", "0.999"};
+        family_(os, name, "summary", help);
+        for (auto &t : tasks) {
+            for (auto &s : t.stages) {
+                const MediaHistogram &h = histogram(s);
+                std::string labels = stageLabels_(t, s);
+                for (auto q : quantiles) {
+                    os << name << "{" << labels << ",quantile=\"" << q << "\"} "
+                       << h.percentile(std::stod(q) * 100) / 1e9 << "\n";
+                }
+                os << name << "_sum{" << labels << "} " << h.sum() / 1e9 << "\n";
+                os << name << "_count{" << labels << "} " << h.count() << "\n";
+            }
+        }
+    }
+
+    // one listener thread, requests served one by one, scrapes are rare.
+    void serve_(const int fd, const bool control) {
+        running_ = true;
+        threads_.emplace_back([this, fd, control]() {
+            while (running_) {
+                struct pollfd pfd = {fd, POLLIN, 0};
+                if (::poll(&pfd, 1, 200) <= 0) {
+                    continue;
+                }
+                int conn = ::accept(fd, nullptr, nullptr);
+                if (conn < 0) {
+                    continue;
+                }
+                respond_(conn, control);
+                ::close(conn);
+            }
+            ::close(fd);
+        });
+    }
+
+    // GET /tasks lists tasks, one per line: name, cpu usage, cpu quota, memory, memory quota and 1 if
+    // throttled. POST /tasks starts the pipeline config in the body, quota from its "quota" or the
+    // default. POST /tasks/<name>/stop or /tasks/<name>/drain ends a task and answers when it left.
+    std::string control_(const std::string &method, const std::string &target, const std::string &body,
+                         std::string &status) {
+        std::ostringstream os;
+        if (target == "/tasks" && method == "GET") {
+            for (auto &t : host_.list()) {
+                os << t.name << " " << t.cpuUsage << " " << t.quota.cpu << " " << t.memory << " "
+                   << t.quota.memory << " " << (t.throttled ? 1 : 0) << "\n";
+            }
+            return os.str();
+        }
+        if (target == "/tasks" && method == "POST") {
+            std::shared_ptr<BaseMediaProcessRunloop> runloop;
+            MediaTaskQuota quota;
+            std::string name;
+            try {
+                MediaPipelineConfig config = MediaPipelineConfig::parse(body);
+                name = config.name();
+                quota = config.quota(defaultQuota_);
+                runloop = config.build();
+            } catch (const std::exception &e) {
+                status = "400 Bad Request";
+                return std::string(e.what()) + "\n";
+            }
+            if (!host_.start(name, runloop, quota)) {
+                // its stages were started by build.
+                runloop->shutdown(0);
+                status = "409 Conflict";
+                return "task " + name + " exists or host can not afford its quota.\n";
+            }
+            status = "201 Created";
+            return "task " + name + " started.\n";
+        }
+
+        size_t slash = target.rfind('/');
+        std::string action = target.substr(slash + 1);
+        if (target.compare(0, 7, "/tasks/") == 0 && slash > 7 && method == "POST" &&
+            (action == "stop" || action == "drain")) {
+            std::string name = target.substr(7, slash - 7);
+            if (action == "stop") {
+                host_.stop(name);
+                return "task " + name + " stopped.\n";
+            }
+            if (!host_.drain(name)) {
+                return "task " + name + " drained, elements dropped at timeout.\n";
+            }
+            return "task " + name + " drained.\n";
+        }
+        status = "404 Not Found";
+        return "unknown request " + method + " " + target + ".\n";
+    }
+
+    void respond_(const int conn, const bool control) {
+        struct timeval timeout = {1, 0};
+        ::setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        // read till end of headers, then the body of a control request.
+        std::string request;
+        char buf[1024];
+        size_t end = std::string::npos;
+        while ((end = request.find("\r\n\r\n")) == std::string::npos && request.size() < 8192) {
+            ssize_t n = ::recv(conn, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                break;
+            }
+            request.append(buf, n);
+        }
+        std::string method;
+        std::string target;
+        std::istringstream(request) >> method >> target;
+        std::string body;
+        if (control && end != std::string::npos) {
+            body = request.substr(end + 4);
+            size_t length = contentLength_(request.substr(0, end));
+            while (body.size() < length && body.size() < kMaxBody) {
+                ssize_t n = ::recv(conn, buf, sizeof(buf), 0);
+                if (n <= 0) {
+                    break;
+                }
+                body.append(buf, n);
+            }
+        }
+
+        std::string status = "200 OK";
+        std::string content;
+        if (control && (target == "/tasks" || target.compare(0, 7, "/tasks/") == 0)) {
+            content = control_(method, target, body, status);
+        } else if (method == "GET") {
+            std::ostringstream os;
+            write(os);
+            content = os.str();
+        } else {
+            status = "405 Method Not Allowed";
+        }
+        std::string response = "HTTP/1.1 " + status + "\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: " + std::to_string(content.size()) + "\r\n"
+            "Connection: close\r\n\r\n" + content;
+
+        size_t sent = 0;
+        while (sent < response.size()) {
+            ssize_t n = ::send(conn, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                break;
+            }
+            sent += n;
+        }
+    }
+
+    static size_t contentLength_(const std::string &headers) {
+        std::string lower;
+        for (auto c : headers) {
+            lower += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        size_t pos = lower.find("\r\ncontent-length:");
+        if (pos == std::string::npos) {
+            return 0;
+        }
+        return std::strtoul(lower.c_str() + pos + 17, nullptr, 10);
+    }
+
+    // pipeline configs are small.
+    static const size_t kMaxBody = 1 << 20;
+
+    MediaTaskHost &host_;
+    MediaTaskQuota defaultQuota_;
+    uint16_t tcpPort_ = 0;
+    std::atomic<bool> running_{false};
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<std::thread> threads_;
+};
+
+#endif  // MEDIA_METRICS_H_
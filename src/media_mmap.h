@@ -0,0 +1,162 @@
+#ifndef MEDIA_MMAP_H_
+#define MEDIA_MMAP_H_
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "media_element.h"
+
+// whole file mapped copy on write, buffers view into it without read copies.
+class MediaMappedFile {
+ public:
+    static std::shared_ptr<MediaMappedFile> open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("can not open " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) < 0) {
+            ::close(fd);
+            throw std::runtime_error("can not stat " + path);
+        }
+
+        std::shared_ptr<MediaMappedFile> file(new MediaMappedFile());
+        file->path_ = path;
+        file->size_ = static_cast<size_t>(st.st_size);
+        if (file->size_) {
+            // private writable mapping, stages may modify a frame in place, only that page is copied.
+            void *data = ::mmap(nullptr, file->size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("can not mmap " + path);
+            }
+            file->data_ = static_cast<uint8_t *>(data);
+        }
+        ::close(fd);
+        return file;
+    }
+
+    ~MediaMappedFile() {
+        if (data_) {
+            ::munmap(data_, size_);
+        }
+    }
+
+    MediaMappedFile(const MediaMappedFile &) = delete;
+    MediaMappedFile &operator=(const MediaMappedFile &) = delete;
+
+    const std::string &path() const {
+        return path_;
+    }
+
+    const size_t size() const {
+        return size_;
+    }
+
+    uint8_t *data() const {
+        return data_;
+    }
+
+    // access pattern hint for a range, MADV_SEQUENTIAL to read ahead, MADV_WILLNEED to prefetch,
+    // MADV_DONTNEED to drop pages already consumed.
+    void advise(const int advice, const size_t &offset = 0, const size_t &length = SIZE_MAX) const {
+        if (!data_ || offset >= size_) {
+            return;
+        }
+        size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        size_t begin = offset / page * page;
+        size_t end = length > size_ - offset ? size_ : offset + length;
+        ::madvise(data_ + begin, end - begin, advice);
+    }
+
+ private:
+    MediaMappedFile() {}
+
+    std::string path_;
+    size_t size_ = 0;
+    uint8_t *data_ = nullptr;
+};
+
+// buffer viewing into a mapped file, mapping kept alive while the buffer is.
+class MediaMappedBuffer: public BaseMediaBuffer {
+ public:
+    MediaMappedBuffer(const std::shared_ptr<MediaMappedFile> &file, const size_t &offset, const size_t &size):
+        BaseMediaBuffer(file->data() + offset, size), file_(file) {
+        if (offset > file->size() || size > file->size() - offset) {
+            throw std::runtime_error("view out of " + file->path());
+        }
+    }
+
+    const std::shared_ptr<MediaMappedFile> &file() const {
+        return file_;
+    }
+
+ private:
+    std::shared_ptr<MediaMappedFile> file_;
+};
+
+// buffer in an anonymous memory file, its fd can be passed to another process which maps the same pages.
+class MediaMemfdBuffer: public BaseMediaBuffer {
+ public:
+    static std::shared_ptr<MediaMemfdBuffer> create(const size_t &size) {
+        int fd = static_cast<int>(::syscall(SYS_memfd_create, "media-buffer", 1U /* MFD_CLOEXEC */));
+        if (fd < 0) {
+            throw std::runtime_error("can not create memfd.");
+        }
+        if (::ftruncate(fd, static_cast<off_t>(size)) < 0) {
+            ::close(fd);
+            throw std::runtime_error("can not size memfd.");
+        }
+        return adopt(fd, size);
+    }
+
+    // take ownership of fd, e.g. received from another process, mapped up to size.
+    static std::shared_ptr<MediaMemfdBuffer> adopt(const int fd, const size_t &size) {
+        struct stat st;
+        if (::fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < size) {
+            ::close(fd);
+            throw std::runtime_error("memfd smaller than buffer.");
+        }
+        uint8_t *data = nullptr;
+        if (size) {
+            void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("can not mmap memfd.");
+            }
+            data = static_cast<uint8_t *>(p);
+        }
+        return std::shared_ptr<MediaMemfdBuffer>(new MediaMemfdBuffer(fd, data, size));
+    }
+
+    ~MediaMemfdBuffer() {
+        if (map_) {
+            ::munmap(map_, mapSize_);
+        }
+        ::close(fd_);
+    }
+
+    const int fd() const {
+        return fd_;
+    }
+
+    // false once resize copied the data out of the memory file.
+    const bool inMemfd() const {
+        return data_ == map_;
+    }
+
+ private:
+    MediaMemfdBuffer(const int fd, uint8_t *data, const size_t &size):
+        BaseMediaBuffer(data, size), fd_(fd), map_(data), mapSize_(size) {}
+
+    int fd_;
+    uint8_t *map_;
+    size_t mapSize_;
+};
+
+#endif  // MEDIA_MMAP_H_
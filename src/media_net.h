@@ -0,0 +1,796 @@
+#ifndef MEDIA_NET_H_
+#define MEDIA_NET_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "media_element.h"
+#include "media_process.h"
+
+// elements over tcp between nodes, both ends in the same byte order.
+//
+// frame:   frame header, then for an element
+//          table   per buffer    u32 name size, u32 0, u64 size, name,
+//                  per metadata  u32 name size, u32 value size, name, value (as stored in element),
+//          payload buffer data in table order.
+// credit:  receiver grants count more elements to the sender, window at connect, then as it emits.
+// end:     sender closed, receiver ends its stream.
+
+enum MediaNetFrameType {
+    MediaNetFrameElement = 1,
+    MediaNetFrameCredit = 2,
+    MediaNetFrameEnd = 3,
+};
+
+struct MediaNetFrameHeader {
+    uint32_t magic;
+    uint32_t type;
+    // credit count for credit frame.
+    uint32_t metadataCount;
+    uint32_t bufferCount;
+    uint32_t tableSize;
+    uint32_t reserved;
+    uint64_t payloadSize;
+};
+
+static const uint32_t kMediaNetMagic = 0x54454e4d;
+
+struct MediaNetOptions {
+    // elements the sender may have in flight, granted by the receiver.
+    size_t window = 64;
+    // queued elements are written together by one writev, up to this many bytes.
+    size_t batchBytes = 4 << 20;
+    size_t reconnectDelayMs = 200;
+    // close gives up on elements not sent after this while disconnected.
+    size_t closeTimeoutMs = 5000;
+    // largest element table accepted.
+    size_t maxTableBytes = 1 << 20;
+    // largest element payload accepted, buffers of a frame together.
+    size_t maxPayloadBytes = 1 << 30;
+    // receive buffers are pooled by power of two size class, for this many classes.
+    size_t poolSizes = 8;
+    size_t poolMaxFree = 64;
+    // a link silent this long is probed, and dropped when the peer does not answer or does not ack
+    // sent data for this long, so a half-open link does not hang either end. 0 for off.
+    size_t keepAliveMs = 10000;
+};
+
+// low latency, and keepalive of options on a connected socket.
+inline void mediaNetSetSocketOptions(const int fd, const MediaNetOptions &options) {
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (!options.keepAliveMs) {
+        return;
+    }
+    int idle = static_cast<int>(std::max<size_t>(options.keepAliveMs / 2000, 1));
+    int interval = static_cast<int>(std::max<size_t>(options.keepAliveMs / 6000, 1));
+    int count = 3;
+    unsigned int timeout = static_cast<unsigned int>(options.keepAliveMs);
+    ::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    ::setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout));
+}
+
+// sending end, connects to a MediaTcpGenerator and connects again when the link breaks.
+// buffers are written from the elements by writev without copy, a writer thread does the io,
+// input blocks when the receiver has granted no credit. elements in flight when the link breaks are lost,
+// those of a failed write are counted in lost.
+class MediaTcpSink: public BaseMediaProcessCollapsar {
+ public:
+    MediaTcpSink(const std::string &host, const uint16_t &port, const MediaNetOptions &options = MediaNetOptions()):
+        host_(host), port_(port), options_(options) {
+        writer_ = std::thread(&MediaTcpSink::writeLoop_, this);
+        reader_ = std::thread(&MediaTcpSink::readLoop_, this);
+    }
+
+    ~MediaTcpSink() {
+        close();
+    }
+
+    virtual const size_t getInputCount() const {
+        return 1;
+    }
+
+    virtual const size_t getOutputCount() const {
+        return 0;
+    }
+
+    virtual void input(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
+        Pending pending;
+        std::map<std::string, std::shared_ptr<BaseMediaBuffer> > buffers = mediaElement->getMediaBuffers();
+        std::map<std::string, std::string> metadata = mediaElement->getRawMetadata();
+        MediaNetFrameHeader header;
+        ::memset(&header, 0, sizeof(header));
+        std::string &head = pending.head;
+        head.resize(sizeof(header));
+        for (auto &it : buffers) {
+            if (!it.second) {
+                continue;
+            }
+            append_(head, static_cast<uint32_t>(it.first.size()));
+            append_(head, static_cast<uint32_t>(0));
+            append_(head, static_cast<uint64_t>(it.second->size()));
+            head += it.first;
+            header.payloadSize += it.second->size();
+            pending.buffers.emplace_back(it.second);
+        }
+        for (auto &it : metadata) {
+            append_(head, static_cast<uint32_t>(it.first.size()));
+            append_(head, static_cast<uint32_t>(it.second.size()));
+            head += it.first;
+            head += it.second;
+        }
+        header.magic = kMediaNetMagic;
+        header.type = MediaNetFrameElement;
+        header.metadataCount = static_cast<uint32_t>(metadata.size());
+        header.bufferCount = static_cast<uint32_t>(pending.buffers.size());
+        header.tableSize = static_cast<uint32_t>(head.size() - sizeof(header));
+        ::memcpy(&head[0], &header, sizeof(header));
+        pending.bytes = head.size() + header.payloadSize;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (credits_ <= 0 && !closing_ && !interrupted_) {
+            cond_.wait(lock);
+        }
+        if (closing_ || interrupted_) {
+            throw std::runtime_error("tcp sink closed.");
+        }
+        --credits_;
+        pending_.emplace_back(std::move(pending));
+        cond_.notify_all();
+    }
+
+    // wait till queued elements are written.
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while ((!pending_.empty() || writing_) && !stopped_) {
+            doneCond_.wait(lock);
+        }
+    }
+
+    // end of stream from the graph, bounded by the deadline and closeTimeoutMs of options. return false
+    // if elements were lost.
+    virtual bool finish(const MediaStageStats::Clock::time_point &deadline) {
+        return close_(std::min(deadline, std::chrono::steady_clock::now() +
+                                         std::chrono::milliseconds(options_.closeTimeoutMs)));
+    }
+
+    // send what is queued and end the stream of the receiver, within closeTimeoutMs of options.
+    void close() {
+        close_(std::chrono::steady_clock::now() + std::chrono::milliseconds(options_.closeTimeoutMs));
+    }
+
+    virtual void interrupt() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        interrupted_ = true;
+        cond_.notify_all();
+    }
+
+    const bool connected() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return fd_ >= 0;
+    }
+
+    const uint64_t sent() const {
+        return sent_.load();
+    }
+
+    // elements of writes that failed.
+    const uint64_t lost() const {
+        return lost_.load();
+    }
+
+    const uint64_t reconnects() const {
+        return connects_.load() ? connects_.load() - 1 : 0;
+    }
+
+ private:
+    struct Pending {
+        // frame header and table.
+        std::string head;
+        std::vector<std::shared_ptr<BaseMediaBuffer> > buffers;
+        size_t bytes = 0;
+    };
+
+    template <typename T>
+    static void append_(std::string &table, const T &value) {
+        table.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    int connect_() const {
+        struct addrinfo hints;
+        ::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo *result = nullptr;
+        if (::getaddrinfo(host_.c_str(), std::to_string(port_).c_str(), &hints, &result) != 0) {
+            return -1;
+        }
+        int fd = -1;
+        for (struct addrinfo *ai = result; ai; ai = ai->ai_next) {
+            fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                break;
+            }
+            ::close(fd);
+            fd = -1;
+        }
+        ::freeaddrinfo(result);
+        if (fd >= 0) {
+            mediaNetSetSocketOptions(fd, options_);
+        }
+        return fd;
+    }
+
+    // gather frames and buffers, IOV_MAX at a time.
+    static bool send_(const int fd, const std::vector<Pending> &batch) {
+        std::vector<struct iovec> iovs;
+        for (auto &pending : batch) {
+            iovs.push_back({const_cast<char *>(pending.head.data()), pending.head.size()});
+            for (auto &buffer : pending.buffers) {
+                if (buffer->size()) {
+                    iovs.push_back({buffer->data(), buffer->size()});
+                }
+            }
+        }
+        return sendAll_(fd, iovs);
+    }
+
+    static bool sendAll_(const int fd, std::vector<struct iovec> &iovs) {
+        size_t i = 0;
+        while (i < iovs.size()) {
+            struct msghdr msg;
+            ::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iovs[i];
+            msg.msg_iovlen = std::min<size_t>(iovs.size() - i, IOV_MAX);
+            ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            size_t left = static_cast<size_t>(n);
+            while (i < iovs.size() && left >= iovs[i].iov_len) {
+                left -= iovs[i].iov_len;
+                ++i;
+            }
+            if (left) {
+                iovs[i].iov_base = static_cast<uint8_t *>(iovs[i].iov_base) + left;
+                iovs[i].iov_len -= left;
+            }
+        }
+        return true;
+    }
+
+    // elements not sent by the deadline are dropped, a write blocked on a receiver that does not
+    // read is broken then. return false if elements were lost.
+    bool close_(const std::chrono::steady_clock::time_point &deadline) {
+        uint64_t lost;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (stopped_ && !writer_.joinable()) {
+                return true;
+            }
+            lost = lost_.load();
+            closing_ = true;
+            closeDeadline_ = deadline;
+            cond_.notify_all();
+            while (!writerDone_ && doneCond_.wait_until(lock, deadline) != std::cv_status::timeout) {
+            }
+            if (!writerDone_ && fd_ >= 0) {
+                ::shutdown(fd_, SHUT_RDWR);
+            }
+        }
+        if (writer_.joinable()) {
+            writer_.join();
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stopped_ = true;
+            cond_.notify_all();
+            doneCond_.notify_all();
+        }
+        if (reader_.joinable()) {
+            reader_.join();
+        }
+        return lost_.load() == lost;
+    }
+
+    // lock held, reader leaves the socket before it is closed.
+    void disconnect_(std::unique_lock<std::mutex> &lock) {
+        ::shutdown(fd_, SHUT_RDWR);
+        while (readerActive_) {
+            doneCond_.wait(lock);
+        }
+        ::close(fd_);
+        fd_ = -1;
+        broken_ = false;
+        credits_ = 0;
+    }
+
+    void writeLoop_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            if (fd_ < 0) {
+                if (interrupted_ || (closing_ && (pending_.empty() ||
+                                                   std::chrono::steady_clock::now() >= closeDeadline_))) {
+                    lost_ += pending_.size();
+                    pending_.clear();
+                    writerDone_ = true;
+                    doneCond_.notify_all();
+                    return;
+                }
+                lock.unlock();
+                int fd = connect_();
+                lock.lock();
+                if (fd < 0) {
+                    cond_.wait_for(lock, std::chrono::milliseconds(options_.reconnectDelayMs));
+                    continue;
+                }
+                fd_ = fd;
+                ++gen_;
+                ++connects_;
+                // elements queued took credits of the last link, receiver grants a whole window again.
+                credits_ = -static_cast<int64_t>(pending_.size());
+                cond_.notify_all();
+            }
+
+            while (pending_.empty() && !closing_ && !broken_ && !interrupted_) {
+                cond_.wait(lock);
+            }
+            if (broken_) {
+                disconnect_(lock);
+                continue;
+            }
+            if (closing_ && !pending_.empty() && std::chrono::steady_clock::now() >= closeDeadline_) {
+                lost_ += pending_.size();
+                pending_.clear();
+            }
+            if (pending_.empty()) {
+                // closing.
+                MediaNetFrameHeader end;
+                ::memset(&end, 0, sizeof(end));
+                end.magic = kMediaNetMagic;
+                end.type = MediaNetFrameEnd;
+                int fd = fd_;
+                lock.unlock();
+                ::send(fd, &end, sizeof(end), MSG_NOSIGNAL);
+                lock.lock();
+                // close only after receiver did, closing with credits unread resets the link
+                // and the receiver may lose the end frame.
+                ::shutdown(fd_, SHUT_WR);
+                doneCond_.wait_until(lock, closeDeadline_, [this]() { return !readerActive_; });
+                disconnect_(lock);
+                writerDone_ = true;
+                doneCond_.notify_all();
+                return;
+            }
+
+            std::vector<Pending> batch;
+            size_t bytes = 0;
+            while (!pending_.empty() && (batch.empty() || bytes + pending_.front().bytes <= options_.batchBytes)) {
+                bytes += pending_.front().bytes;
+                batch.emplace_back(std::move(pending_.front()));
+                pending_.pop_front();
+            }
+            writing_ = true;
+            int fd = fd_;
+            lock.unlock();
+            bool ok = send_(fd, batch);
+            size_t count = batch.size();
+            // buffers released out of lock.
+            batch.clear();
+            lock.lock();
+            writing_ = false;
+            if (ok) {
+                sent_ += count;
+            } else {
+                lost_ += count;
+                disconnect_(lock);
+            }
+            doneCond_.notify_all();
+        }
+    }
+
+    static bool recvAll_(const int fd, void *data, const size_t &size) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = ::recv(fd, static_cast<uint8_t *>(data) + done, size - done, 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    // credits from receiver, a read error marks the link broken for the writer.
+    void readLoop_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t gen = 0;
+        while (true) {
+            while (!stopped_ && (fd_ < 0 || gen == gen_)) {
+                cond_.wait(lock);
+            }
+            if (stopped_) {
+                return;
+            }
+            gen = gen_;
+            int fd = fd_;
+            readerActive_ = true;
+            lock.unlock();
+
+            MediaNetFrameHeader header;
+            while (recvAll_(fd, &header, sizeof(header)) && header.magic == kMediaNetMagic) {
+                if (header.type == MediaNetFrameCredit) {
+                    std::unique_lock<std::mutex> creditLock(mutex_);
+                    credits_ += header.metadataCount;
+                    cond_.notify_all();
+                }
+            }
+
+            lock.lock();
+            readerActive_ = false;
+            if (gen == gen_ && fd_ >= 0) {
+                broken_ = true;
+            }
+            cond_.notify_all();
+            doneCond_.notify_all();
+        }
+    }
+
+    std::string host_;
+    uint16_t port_;
+    MediaNetOptions options_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::condition_variable doneCond_;
+    int fd_ = -1;
+    uint64_t gen_ = 0;
+    bool broken_ = false;
+    bool readerActive_ = false;
+    bool writing_ = false;
+    int64_t credits_ = 0;
+    std::deque<Pending> pending_;
+    bool closing_ = false;
+    bool stopped_ = false;
+    bool writerDone_ = false;
+    bool interrupted_ = false;
+    std::chrono::steady_clock::time_point closeDeadline_;
+
+    std::atomic<uint64_t> sent_{0};
+    std::atomic<uint64_t> lost_{0};
+    std::atomic<uint64_t> connects_{0};
+    std::thread writer_;
+    std::thread reader_;
+};
+
+// receiving end, listens and takes one sender at a time, a new connection replaces a broken one.
+// small reads are served from a staging buffer, buffer data is received straight into pooled buffers.
+// stream ends when the sender closes.
+class MediaTcpGenerator: public BaseMediaProcessGenerator {
+ public:
+    enum {
+        kStagingSize = 256 << 10,
+        // smallest size class of receive pools.
+        kMinPoolSize = 4 << 10,
+    };
+
+    // port 0 picks a free one, see port.
+    explicit MediaTcpGenerator(const uint16_t &port, const std::string &bindAddress = "127.0.0.1",
+                               const MediaNetOptions &options = MediaNetOptions()):
+        options_(options), staging_(kStagingSize) {
+        struct sockaddr_in addr;
+        ::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        if (::inet_pton(AF_INET, bindAddress.c_str(), &addr.sin_addr) != 1) {
+            throw std::runtime_error("bad bind address " + bindAddress);
+        }
+        listenFd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int one = 1;
+        ::setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (listenFd_ < 0 || ::bind(listenFd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+            ::listen(listenFd_, 4) < 0) {
+            if (listenFd_ >= 0) {
+                ::close(listenFd_);
+            }
+            throw std::runtime_error("can not listen on " + bindAddress + ":" + std::to_string(port));
+        }
+        socklen_t length = sizeof(addr);
+        ::getsockname(listenFd_, reinterpret_cast<struct sockaddr *>(&addr), &length);
+        port_ = ntohs(addr.sin_port);
+    }
+
+    ~MediaTcpGenerator() {
+        // listener first, a sender seeing the link drop should not reconnect into it.
+        ::close(listenFd_);
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    virtual const size_t getInputCount() const {
+        return 0;
+    }
+
+    virtual const size_t getOutputCount() const {
+        return 1;
+    }
+
+    const uint16_t port() const {
+        return port_;
+    }
+
+    const uint64_t connections() const {
+        return connections_;
+    }
+
+    virtual bool generate() {
+        while (!interrupted_) {
+            if (fd_ < 0 && !accept_()) {
+                continue;
+            }
+            MediaNetFrameHeader header;
+            if (!read_(&header, sizeof(header)) || header.magic != kMediaNetMagic) {
+                // sender gone, wait for it to connect again.
+                disconnect_();
+                continue;
+            }
+            if (header.type == MediaNetFrameEnd) {
+                disconnect_();
+                return false;
+            }
+            if (header.type != MediaNetFrameElement || header.tableSize > options_.maxTableBytes ||
+                header.payloadSize > options_.maxPayloadBytes) {
+                std::cerr << "bad tcp frame, dropping connection." << std::endl;
+                disconnect_();
+                continue;
+            }
+            std::shared_ptr<BaseMediaElement> me = element_(header);
+            if (!me) {
+                disconnect_();
+                continue;
+            }
+            outputHandlers_[0](me);
+
+            // emitted downstream, so the sender may send one more.
+            if (++consumed_ >= std::max<size_t>(options_.window / 2, 1)) {
+                credit_(static_cast<uint32_t>(consumed_));
+                consumed_ = 0;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    virtual void interrupt() {
+        interrupted_ = true;
+    }
+
+ private:
+    // wait for a sender, polled so interrupt is seen.
+    bool accept_() {
+        struct pollfd pfd = {listenFd_, POLLIN, 0};
+        if (::poll(&pfd, 1, 100) <= 0) {
+            return false;
+        }
+        int fd = ::accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        mediaNetSetSocketOptions(fd, options_);
+        fd_ = fd;
+        stagingBegin_ = stagingEnd_ = 0;
+        consumed_ = 0;
+        ++connections_;
+        credit_(static_cast<uint32_t>(options_.window));
+        return true;
+    }
+
+    void disconnect_() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    void credit_(const uint32_t &count) {
+        MediaNetFrameHeader header;
+        ::memset(&header, 0, sizeof(header));
+        header.magic = kMediaNetMagic;
+        header.type = MediaNetFrameCredit;
+        header.metadataCount = count;
+        if (fd_ >= 0 && ::send(fd_, &header, sizeof(header), MSG_NOSIGNAL) != sizeof(header)) {
+            disconnect_();
+        }
+    }
+
+    // wait readable, false on interrupt. a sender connecting again replaces the link, the one
+    // waited on may be half-open after the sender saw it break.
+    bool poll_() {
+        while (!interrupted_) {
+            struct pollfd pfds[2] = {{fd_, POLLIN, 0}, {listenFd_, POLLIN, 0}};
+            int n = ::poll(pfds, 2, 100);
+            if (n > 0 && pfds[0].revents) {
+                return true;
+            }
+            if (n > 0) {
+                std::cerr << "tcp sender connected again, dropping the old connection." << std::endl;
+                return false;
+            }
+            if (n < 0 && errno != EINTR) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // staging first, large reads go straight to destination.
+    bool read_(void *data, const size_t &size) {
+        uint8_t *p = static_cast<uint8_t *>(data);
+        size_t done = std::min(size, stagingEnd_ - stagingBegin_);
+        ::memcpy(p, staging_.data() + stagingBegin_, done);
+        stagingBegin_ += done;
+        while (done < size) {
+            if (!poll_()) {
+                return false;
+            }
+            bool direct = size - done >= kStagingSize / 2;
+            uint8_t *dst = direct ? p + done : staging_.data();
+            ssize_t n = ::recv(fd_, dst, direct ? size - done : static_cast<size_t>(kStagingSize), 0);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            if (direct) {
+                done += n;
+            } else {
+                stagingBegin_ = 0;
+                stagingEnd_ = n;
+                size_t copied = std::min(size - done, stagingEnd_);
+                ::memcpy(p + done, staging_.data(), copied);
+                stagingBegin_ = copied;
+                done += copied;
+            }
+        }
+        return true;
+    }
+
+    // pooled by power of two size class, so frames of varying size share pools.
+    std::shared_ptr<BaseMediaBuffer> buffer_(const size_t &size) {
+        if (!size || size > (SIZE_MAX >> 1)) {
+            return std::make_shared<BaseMediaBuffer>(size);
+        }
+        size_t sizeClass = kMinPoolSize;
+        while (sizeClass < size) {
+            sizeClass <<= 1;
+        }
+        auto it = pools_.find(sizeClass);
+        if (it == pools_.end()) {
+            if (pools_.size() >= options_.poolSizes) {
+                return std::make_shared<BaseMediaBuffer>(size);
+            }
+            it = pools_.emplace(sizeClass, std::make_shared<BaseMediaBufferPool>(sizeClass, options_.poolMaxFree)).first;
+        }
+        std::shared_ptr<BaseMediaBuffer> pooled = it->second->acquire();
+        if (size == sizeClass) {
+            return pooled;
+        }
+        // pooled one goes back to its pool with the view.
+        return std::make_shared<MediaBufferView>(pooled, size);
+    }
+
+    // nullptr if frame is bad or link broke.
+    std::shared_ptr<BaseMediaElement> element_(const MediaNetFrameHeader &header) {
+        std::vector<uint8_t> table(header.tableSize);
+        if (!read_(table.data(), table.size())) {
+            return nullptr;
+        }
+        auto me = std::make_shared<BaseMediaElement>();
+        const uint8_t *p = table.data();
+        const uint8_t *end = p + table.size();
+        std::vector<std::pair<std::string, uint64_t> > buffers;
+        uint64_t payload = 0;
+        for (uint32_t i = 0; i < header.bufferCount; ++i) {
+            uint32_t nameSize;
+            uint64_t size;
+            // sizes checked one by one, their sum must not wrap around to the payload size.
+            if (!take_(p, end, &nameSize) || !skip_(p, end, sizeof(uint32_t)) || !take_(p, end, &size) ||
+                static_cast<size_t>(end - p) < nameSize || size > header.payloadSize - payload) {
+                return nullptr;
+            }
+            buffers.emplace_back(std::string(reinterpret_cast<const char *>(p), nameSize), size);
+            p += nameSize;
+            payload += size;
+        }
+        if (payload != header.payloadSize) {
+            return nullptr;
+        }
+        for (uint32_t i = 0; i < header.metadataCount; ++i) {
+            uint32_t nameSize;
+            uint32_t valueSize;
+            if (!take_(p, end, &nameSize) || !take_(p, end, &valueSize) ||
+                static_cast<size_t>(end - p) < static_cast<size_t>(nameSize) + valueSize) {
+                return nullptr;
+            }
+            std::string name(reinterpret_cast<const char *>(p), nameSize);
+            p += nameSize;
+            me->setRawMetadata(name, std::string(reinterpret_cast<const char *>(p), valueSize));
+            p += valueSize;
+        }
+        for (auto &it : buffers) {
+            std::shared_ptr<BaseMediaBuffer> buffer = buffer_(it.second);
+            if (!read_(buffer->data(), it.second)) {
+                return nullptr;
+            }
+            me->setMediaBuffer(it.first, buffer);
+        }
+        return me;
+    }
+
+    template <typename T>
+    static bool take_(const uint8_t *&p, const uint8_t *end, T *value) {
+        if (static_cast<size_t>(end - p) < sizeof(T)) {
+            return false;
+        }
+        ::memcpy(value, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+
+    static bool skip_(const uint8_t *&p, const uint8_t *end, const size_t &size) {
+        if (static_cast<size_t>(end - p) < size) {
+            return false;
+        }
+        p += size;
+        return true;
+    }
+
+    MediaNetOptions options_;
+    int listenFd_ = -1;
+    uint16_t port_ = 0;
+    int fd_ = -1;
+    uint64_t connections_ = 0;
+    size_t consumed_ = 0;
+    std::vector<uint8_t> staging_;
+    size_t stagingBegin_ = 0;
+    size_t stagingEnd_ = 0;
+    std::map<size_t, std::shared_ptr<BaseMediaBufferPool> > pools_;
+    std::atomic<bool> interrupted_{false};
+};
+
+#endif  // MEDIA_NET_H_
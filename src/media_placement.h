@@ -0,0 +1,133 @@
+#ifndef MEDIA_PLACEMENT_H_
+#define MEDIA_PLACEMENT_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+// where threads of a stage run and where they allocate memory.
+class MediaPlacement {
+ public:
+    MediaPlacement() {}
+
+    // pin to cpus, memory not bound.
+    static MediaPlacement onCpus(const std::vector<int> &cpus) {
+        MediaPlacement placement;
+        placement.cpus_ = cpus;
+        return placement;
+    }
+
+    // pin to cpus of node, memory allocated by these threads prefer the node.
+    static MediaPlacement onNode(const int node) {
+        MediaPlacement placement;
+        placement.node_ = node;
+        placement.cpus_ = nodeCpus(node);
+        return placement;
+    }
+
+    // next node in turn, so pipelines spread over nodes and each stays on one node.
+    static MediaPlacement autoNode() {
+        static std::atomic<size_t> next{0};
+        return onNode(static_cast<int>(next++ % nodeCount()));
+    }
+
+    static size_t nodeCount() {
+        size_t count = 0;
+        while (std::ifstream("/sys/devices/system/node/node" + std::to_string(count) + "/cpulist")) {
+            ++count;
+        }
+        return count ? count : 1;
+    }
+
+    // parse cpulist like "0-3,8-11".
+    static std::vector<int> nodeCpus(const int node) {
+        std::vector<int> cpus;
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string item;
+        while (std::getline(in, item, ',')) {
+            size_t dash = item.find('-');
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.emplace_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    bool empty() const {
+        return cpus_.empty() && node_ < 0;
+    }
+
+    const std::vector<int> &cpus() const {
+        return cpus_;
+    }
+
+    const int node() const {
+        return node_;
+    }
+
+    // apply to current thread, call it at the beginning of stage threads.
+    // false if a part failed, the thread runs unplaced in that part then. failures are reported once.
+    bool apply() const {
+        bool ok = true;
+        if (!cpus_.empty()) {
+            // sets sized to the highest cpu, CPU_SET on a plain cpu_set_t stops at CPU_SETSIZE.
+            int maxCpu = std::max(0, *std::max_element(cpus_.begin(), cpus_.end()));
+            cpu_set_t *set = CPU_ALLOC(maxCpu + 1);
+            size_t size = CPU_ALLOC_SIZE(maxCpu + 1);
+            CPU_ZERO_S(size, set);
+            for (auto cpu : cpus_) {
+                if (cpu >= 0) {
+                    CPU_SET_S(cpu, size, set);
+                }
+            }
+            int error = pthread_setaffinity_np(pthread_self(), size, set);
+            CPU_FREE(set);
+            if (error) {
+                ok = false;
+                static std::atomic<bool> reported{false};
+                report_(reported, "can not pin thread to cpus", error);
+            }
+        }
+
+        if (node_ >= 0) {
+            // new pages of this thread come from the node first, e.g. frame buffers allocated by the stage.
+            const size_t bits = sizeof(unsigned long) * CHAR_BIT;
+            std::vector<unsigned long> mask(node_ / bits + 1, 0);
+            mask[node_ / bits] = 1UL << (node_ % bits);
+            // the kernel takes one bit less than maxnode.
+            if (::syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(), mask.size() * bits + 1) < 0) {
+                int error = errno;
+                ok = false;
+                static std::atomic<bool> reported{false};
+                report_(reported, "can not prefer memory of node " + std::to_string(node_), error);
+            }
+        }
+        return ok;
+    }
+
+ private:
+    static void report_(std::atomic<bool> &reported, const std::string &what, const int error) {
+        if (!reported.exchange(true)) {
+            std::cerr << "placement: " << what << ": " << ::strerror(error) << std::endl;
+        }
+    }
+
+    std::vector<int> cpus_;
+    int node_ = -1;
+};
+
+#endif  // MEDIA_PLACEMENT_H_
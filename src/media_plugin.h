@@ -0,0 +1,252 @@
+#ifndef MEDIA_PLUGIN_H_
+#define MEDIA_PLUGIN_H_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <dlfcn.h>
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#endif
+#include "media_config.h"
+
+// stages shipped as shared objects. a plugin exports MEDIA_PLUGIN_ENTRY with c linkage, returning its
+// info: name, version and variants of its stages per instruction set, best first. the host loads the
+// first variant the cpu supports and that variant adds its factories to the registry.
+//
+// static BaseMediaProcess *makeBlur(const MediaStageParams *params) { return new Blur(*params); }
+// static int stagesAvx2(const MediaPluginHost *host) { return host->addStage(host->context, "blur", makeBlurAvx2); }
+// static int stages(const MediaPluginHost *host) { return host->addStage(host->context, "blur", makeBlur); }
+// static const MediaPluginVariant variants[] = {{"avx2", stagesAvx2}, {"generic", stages}};
+// MEDIA_PLUGIN_DEFINE("blur", "1.0", variants);
+//
+// stages cross as c++ objects, so plugins are built with the same compiler abi and media headers as
+// the host, checked by the version numbers in the info. plugins stay loaded until exit, stages they
+// made may live anywhere. the server exports its symbols, so shared framework state such as stats
+// and lock profiles resolves to the server copy, not one per plugin.
+
+// bumped when the structs below or the media classes plugins derive from change incompatibly.
+#define MEDIA_PLUGIN_ABI_VERSION 1
+#define MEDIA_PLUGIN_ENTRY media_plugin_entry_v1
+#define MEDIA_PLUGIN_ENTRY_NAME "media_plugin_entry_v1"
+#if defined(__GXX_ABI_VERSION)
+#define MEDIA_PLUGIN_CXX_ABI __GXX_ABI_VERSION
+#else
+#define MEDIA_PLUGIN_CXX_ABI 0
+#endif
+
+extern "C" {
+
+// new stage owned by the caller, params valid during the call.
+typedef BaseMediaProcess *(*MediaPluginFactory)(const MediaStageParams *params);
+
+struct MediaPluginHost {
+    uint32_t abiVersion;
+    void *context;
+    // 0 on success.
+    int (*addStage)(void *context, const char *type, MediaPluginFactory factory);
+};
+
+struct MediaPluginVariant {
+    // "generic", or a cpu feature as gcc names it, e.g. "avx512f", "avx2", "sse4.2", "neon", "sve".
+    const char *isa;
+    // 0 on success.
+    int (*registerStages)(const MediaPluginHost *host);
+};
+
+struct MediaPluginInfo {
+    uint32_t abiVersion;
+    uint32_t cxxAbiVersion;
+    const char *name;
+    const char *version;
+    const MediaPluginVariant *variants;
+    uint32_t variantCount;
+};
+
+typedef const MediaPluginInfo *(*MediaPluginEntry)();
+
+}  // extern "C"
+
+#define MEDIA_PLUGIN_DEFINE(name, version, variants) \
+    extern "C" __attribute__((visibility("default"))) const MediaPluginInfo *MEDIA_PLUGIN_ENTRY() { \
+        static const MediaPluginInfo info = {MEDIA_PLUGIN_ABI_VERSION, MEDIA_PLUGIN_CXX_ABI, name, version, \
+                                             variants, sizeof(variants) / sizeof(variants[0])}; \
+        return &info; \
+    }
+
+struct MediaPluginLoaded {
+    std::string path;
+    std::string name;
+    std::string version;
+    // variant chosen.
+    std::string isa;
+    std::vector<std::string> types;
+};
+
+class MediaPluginLoader {
+ public:
+    explicit MediaPluginLoader(MediaStageRegistry &registry = MediaStageRegistry::instance()):
+        registry_(registry) {}
+
+    // handles are kept, stages made by plugins outlive the loader.
+    MediaPluginLoader(const MediaPluginLoader &) = delete;
+    MediaPluginLoader &operator=(const MediaPluginLoader &) = delete;
+
+    static bool isaSupported(const std::string &isa) {
+        if (isa == "generic") {
+            return true;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        // names must be literals for the builtin.
+        __builtin_cpu_init();
+        if (isa == "avx512f") return __builtin_cpu_supports("avx512f");
+        if (isa == "avx512bw") return __builtin_cpu_supports("avx512bw");
+        if (isa == "avx512vl") return __builtin_cpu_supports("avx512vl");
+        if (isa == "avx2") return __builtin_cpu_supports("avx2");
+        if (isa == "fma") return __builtin_cpu_supports("fma");
+        if (isa == "avx") return __builtin_cpu_supports("avx");
+        if (isa == "sse4.2") return __builtin_cpu_supports("sse4.2");
+        if (isa == "sse4.1") return __builtin_cpu_supports("sse4.1");
+        if (isa == "ssse3") return __builtin_cpu_supports("ssse3");
+        if (isa == "sse2") return __builtin_cpu_supports("sse2");
+        if (isa == "popcnt") return __builtin_cpu_supports("popcnt");
+#elif defined(__aarch64__)
+        if (isa == "neon" || isa == "asimd") return true;
+#if defined(HWCAP_SVE)
+        if (isa == "sve") return (::getauxval(AT_HWCAP) & HWCAP_SVE) != 0;
+#endif
+#endif
+        return false;
+    }
+
+    // loads one plugin, its best supported variant registering its stages.
+    const MediaPluginLoaded load(const std::string &path) {
+        void *handle = ::dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!handle) {
+            throw std::runtime_error("can not load plugin " + path + ": " + ::dlerror());
+        }
+        MediaPluginLoaded loaded;
+        loaded.path = path;
+        try {
+            register_(handle, loaded);
+        } catch (...) {
+            if (loaded.types.empty()) {
+                // nothing of it registered, safe to unload.
+                ::dlclose(handle);
+            } else {
+                // stages added before the failure stay registered, so must their code.
+                std::unique_lock<std::mutex> lock(mutex_);
+                handles_.emplace_back(handle);
+            }
+            throw;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        handles_.emplace_back(handle);
+        loaded_.emplace_back(loaded);
+        return loaded;
+    }
+
+    // every .so in dir, in name order so overrides between plugins are stable.
+    const std::vector<MediaPluginLoaded> loadDirectory(const std::string &dir) {
+        DIR *d = ::opendir(dir.c_str());
+        if (!d) {
+            throw std::runtime_error("can not open plugin directory " + dir + ": " + ::strerror(errno));
+        }
+        std::vector<std::string> paths;
+        while (struct dirent *entry = ::readdir(d)) {
+            std::string name = entry->d_name;
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, ".so") == 0) {
+                paths.emplace_back(dir + (dir.back() == '/' ? "" : "/") + name);
+            }
+        }
+        ::closedir(d);
+        std::sort(paths.begin(), paths.end());
+
+        std::vector<MediaPluginLoaded> loaded;
+        for (auto &path : paths) {
+            loaded.emplace_back(load(path));
+        }
+        return loaded;
+    }
+
+    const std::vector<MediaPluginLoaded> plugins() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return loaded_;
+    }
+
+ private:
+    struct Context {
+        MediaPluginLoader *loader;
+        MediaPluginLoaded *loaded;
+        std::string error;
+    };
+
+    static int addStage_(void *context, const char *type, MediaPluginFactory factory) {
+        Context *c = static_cast<Context *>(context);
+        if (!type || !*type || !factory) {
+            c->error = "bad stage of plugin.";
+            return -1;
+        }
+        std::string name = type;
+        c->loader->registry_.add(name, [factory](const MediaStageParams &params) {
+            std::shared_ptr<BaseMediaProcess> mp(factory(&params));
+            return mp;
+        });
+        c->loaded->types.emplace_back(name);
+        return 0;
+    }
+
+    void register_(void *handle, MediaPluginLoaded &loaded) {
+        const std::string &path = loaded.path;
+        ::dlerror();
+        MediaPluginEntry entry = reinterpret_cast<MediaPluginEntry>(::dlsym(handle, MEDIA_PLUGIN_ENTRY_NAME));
+        if (!entry) {
+            throw std::runtime_error("plugin " + path + " has no " MEDIA_PLUGIN_ENTRY_NAME ".");
+        }
+        const MediaPluginInfo *info = entry();
+        if (!info || info->abiVersion != MEDIA_PLUGIN_ABI_VERSION) {
+            throw std::runtime_error("plugin " + path + " abi version " +
+                                     std::to_string(info ? info->abiVersion : 0) + ", host has " +
+                                     std::to_string(MEDIA_PLUGIN_ABI_VERSION) + ".");
+        }
+        if (info->cxxAbiVersion != MEDIA_PLUGIN_CXX_ABI) {
+            throw std::runtime_error("plugin " + path + " built with another c++ abi.");
+        }
+
+        loaded.name = info->name ? info->name : "";
+        loaded.version = info->version ? info->version : "";
+        const MediaPluginVariant *variant = nullptr;
+        for (uint32_t i = 0; i < info->variantCount; ++i) {
+            const MediaPluginVariant &v = info->variants[i];
+            if (v.isa && v.registerStages && isaSupported(v.isa)) {
+                variant = &v;
+                break;
+            }
+        }
+        if (!variant) {
+            throw std::runtime_error("plugin " + path + " has no variant for this cpu.");
+        }
+        loaded.isa = variant->isa;
+
+        Context context = {this, &loaded, ""};
+        MediaPluginHost host = {MEDIA_PLUGIN_ABI_VERSION, &context, &MediaPluginLoader::addStage_};
+        if (variant->registerStages(&host) != 0 || !context.error.empty()) {
+            throw std::runtime_error("plugin " + path + " failed to register " + loaded.isa + " stages. " +
+                                     context.error);
+        }
+    }
+
+    MediaStageRegistry &registry_;
+    std::mutex mutex_;
+    std::vector<void *> handles_;
+    std::vector<MediaPluginLoaded> loaded_;
+};
+
+#endif  // MEDIA_PLUGIN_H_
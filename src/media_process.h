@@ -1,14 +1,23 @@
 #ifndef MEDIA_PROCESS_H_
 #define MEDIA_PROCESS_H_
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <fstream>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include "media_element.h"
-
-using MediaProcessType = enum {
+#include "media_lock.h"
+#include "media_executor.h"
+#include "media_placement.h"
+#include "media_stats.h"
+#include "media_trace.h"
+#include <cxxabi.h>
+
+enum MediaProcessType {
     MediaProcessTypePipe = 1,
     MediaProcessTypeJoin = 2,
     MediaProcessTypeSplit = 3,
@@ -18,6 +27,146 @@ using MediaProcessType = enum {
     MediaProcessTypeRunloop = 7,
 };
 
+// result of BaseMediaProcessRunloop::step.
+enum MediaRunloopStep {
+    MediaRunloopStepGenerated = 1,
+    // every source paused or busy, see setReadyHandler.
+    MediaRunloopStepIdle = 2,
+    // all sources end, or stopping.
+    MediaRunloopStepEnded = 3,
+};
+
+inline const char *mediaProcessTypeName(const MediaProcessType &type) {
+    switch (type) {
+        case MediaProcessTypePipe: return "pipe";
+        case MediaProcessTypeJoin: return "join";
+        case MediaProcessTypeSplit: return "split";
+        case MediaProcessTypeMultiplex: return "multiplex";
+        case MediaProcessTypeGenerator: return "generator";
+        case MediaProcessTypeCollapsar: return "collapsar";
+        case MediaProcessTypeRunloop: return "runloop";
+    }
+    return "unknown";
+}
+
+class BaseMediaProcess;
+
+// stats of one stage in a composed graph, name is the path from root.
+struct MediaStageSnapshot {
+    std::string name;
+    // demangled class name.
+    std::string className;
+    MediaProcessType type;
+    size_t inputCount;
+    size_t outputCount;
+    MediaStageCounters counters;
+    // queue gauges, for stages with a queue only.
+    bool hasQueue = false;
+    MediaQueueGauges queue;
+};
+
+// topology of a composed graph, stages in snapshot order, edges connect output port to input port.
+struct MediaGraph {
+    enum {
+        kNone = SIZE_MAX,
+    };
+
+    // from or to is a composed stage itself for its own input and output ports.
+    struct Edge {
+        size_t from;
+        size_t fromPort;
+        size_t to;
+        size_t toPort;
+    };
+
+    std::vector<MediaStageSnapshot> stages;
+    // index of parent stage, kNone for root.
+    std::vector<size_t> parents;
+    std::vector<Edge> edges;
+
+    // graphviz, composed stages are clusters, leaf stages show stats read when graph was taken.
+    void writeDot(std::ostream &os) const {
+        std::vector<std::vector<size_t> > children(stages.size());
+        for (size_t i = 0; i < stages.size(); ++i) {
+            if (parents[i] != kNone) {
+                children[parents[i]].emplace_back(i);
+            }
+        }
+
+        os << "digraph media {" << std::endl;
+        os << "    rankdir=LR;" << std::endl;
+        os << "    node [shape=box, fontsize=10];" << std::endl;
+        for (size_t i = 0; i < stages.size(); ++i) {
+            if (parents[i] == kNone) {
+                writeDotStage_(os, i, children, "    ");
+            }
+        }
+        for (auto &e : edges) {
+            // into a composed stage from its child is its output, from it to its child is its input.
+            bool fromInside = parents[e.to] == e.from;
+            bool toInside = parents[e.from] == e.to;
+            os << "    " << dotNode_(e.from, children, !fromInside) << " -> " << dotNode_(e.to, children, toInside)
+               << " [taillabel=\"" << e.fromPort << "\", headlabel=\"" << e.toPort << "\"];" << std::endl;
+        }
+        os << "}" << std::endl;
+    }
+
+ private:
+    static std::string escape_(const std::string &value) {
+        std::string escaped;
+        for (auto c : value) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    // composed stage has an in and an out point, output side when output is true.
+    static std::string dotNode_(const size_t &index, const std::vector<std::vector<size_t> > &children,
+                                const bool output) {
+        std::string node = "s" + std::to_string(index);
+        if (children[index].empty()) {
+            return node;
+        }
+        return node + (output ? "_out" : "_in");
+    }
+
+    void writeDotStage_(std::ostream &os, const size_t &index, const std::vector<std::vector<size_t> > &children,
+                        const std::string &indent) const {
+        const MediaStageSnapshot &s = stages[index];
+        std::string label = escape_(s.name) + "\\n" + escape_(s.className) + " (" + mediaProcessTypeName(s.type) + ")";
+        if (children[index].empty()) {
+            const MediaStageCounters &c = s.counters;
+            os << indent << "s" << index << " [label=\"" << label
+               << "\\nin " << s.inputCount << " out " << s.outputCount
+               << "\\nelements " << c.elements
+               << "\\nprocess p50 " << c.process.percentile(50) / 1000.0 << "us p99 "
+               << c.process.percentile(99) / 1000.0 << "us";
+            if (s.hasQueue) {
+                os << "\\nqueue " << s.queue.depth << " peak " << s.queue.peakDepth
+                   << " wait p99 " << c.wait.percentile(99) / 1000.0 << "us";
+            }
+            os << "\"];" << std::endl;
+            return;
+        }
+
+        os << indent << "subgraph cluster_" << index << " {" << std::endl;
+        os << indent << "    label=\"" << label << "\";" << std::endl;
+        if (s.inputCount) {
+            os << indent << "    s" << index << "_in [shape=point];" << std::endl;
+        }
+        if (s.outputCount) {
+            os << indent << "    s" << index << "_out [shape=point];" << std::endl;
+        }
+        for (auto child : children[index]) {
+            writeDotStage_(os, child, children, indent + "    ");
+        }
+        os << indent << "}" << std::endl;
+    }
+};
+
 
 class MediaProcessInterface {
  public:
@@ -45,10 +194,105 @@ class MediaProcessInterface {
 };
 
 
+class BaseMediaProcess;
+
+// stages of each level of a composition, a level of one stage or of stages in parallel.
+typedef std::vector<std::vector<std::shared_ptr<BaseMediaProcess> > > MediaProcessLevels;
+
+// an edge of a composition, its target can be switched while elements flow. pause waits out the calls
+// in flight and holds new ones till resume, so only this edge stops. a call costs two atomic adds.
+class MediaLink {
+ public:
+    typedef std::function<void(std::shared_ptr<BaseMediaElement>)> Handler;
+
+    explicit MediaLink(const Handler &target): target_(target) {}
+
+    void operator()(const std::shared_ptr<BaseMediaElement> &mediaElement) {
+        enter_();
+        Leave leave(this);
+        target_(mediaElement);
+    }
+
+    // must not be called from a call through this edge, it would wait for itself.
+    void pause() {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        paused_.store(true);
+        while (inflight_.load() > 0) {
+            cond_.wait(lock);
+        }
+    }
+
+    void resume() {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        paused_.store(false);
+        cond_.notify_all();
+    }
+
+    // while paused, or before elements flow.
+    void setTarget(const Handler &target) {
+        target_ = target;
+    }
+
+    const Handler &getTarget() const {
+        return target_;
+    }
+
+ private:
+    struct Leave {
+        explicit Leave(MediaLink *link): link(link) {}
+        ~Leave() {
+            link->leave_();
+        }
+        MediaLink *link;
+    };
+
+    void enter_() {
+        while (true) {
+            // seq cst on both sides, either pause sees this call or this call sees pause.
+            inflight_.fetch_add(1);
+            if (!paused_.load()) {
+                return;
+            }
+            leave_();
+            std::unique_lock<MediaMutex> lock(mutex_);
+            while (paused_.load()) {
+                cond_.wait(lock);
+            }
+        }
+    }
+
+    void leave_() {
+        if (inflight_.fetch_sub(1) == 1 && paused_.load()) {
+            std::unique_lock<MediaMutex> lock(mutex_);
+            cond_.notify_all();
+        }
+    }
+
+    Handler target_;
+    std::atomic<size_t> inflight_{0};
+    std::atomic<bool> paused_{false};
+    MediaMutex mutex_ MEDIA_LOCK_SITE("MediaLink::mutex_");
+    MediaCondition cond_;
+};
+
 class BaseMediaProcess: public MediaProcessInterface {
  public:
     BaseMediaProcess(): errorHandler_(nullptr), generator_(nullptr) {};
 
+    // composition known at run time, e.g. from a pipeline config, levels wired as constructor arguments are.
+    explicit BaseMediaProcess(const MediaProcessLevels &levels): BaseMediaProcess() {
+        for (size_t level = 0; level < levels.size(); ++level) {
+            if (levels[level].empty()) {
+                throw std::runtime_error("empty level in composition.");
+            }
+            if (level == 0 && levels[0].size() == 1) {
+                initSingle_(levels[0][0]);
+            }
+            initLevel_(level, levels[level]);
+        }
+        initEnd_();
+    }
+
     template <typename...Args>
     BaseMediaProcess(Args... args):BaseMediaProcess() {
         init(0, args...);
@@ -66,6 +310,55 @@ class BaseMediaProcess: public MediaProcessInterface {
         errorHandler_ = errorHandler;
     }
 
+    // threads started after this run with placement, sub processes follow unless set again later.
+    virtual void setPlacement(const MediaPlacement &placement) {
+        placement_ = placement;
+        for (auto mp : mps_) {
+            mp->setPlacement(placement);
+        }
+    }
+
+    const MediaPlacement &getPlacement() const {
+        return placement_;
+    }
+
+    // name used in snapshot, index in parent if not set.
+    void setName(const std::string &name) {
+        name_ = name;
+    }
+
+    const std::string &getName() const {
+        return name_;
+    }
+
+    // stats of this and all sub processes, depth first.
+    std::vector<MediaStageSnapshot> snapshot() const {
+        return graph().stages;
+    }
+
+    // stages, port mapping set by init and live stats.
+    MediaGraph graph() const {
+        MediaGraph graph;
+        graph_(name_.empty() ? "root" : name_, MediaGraph::kNone, graph);
+        return graph;
+    }
+
+    void writeDot(std::ostream &os) const {
+        graph().writeDot(os);
+    }
+
+    // allocations and copies per stage, stages allocating on hot path or copying buffers stand out.
+    void writeAllocReport(std::ostream &os) const {
+        os << "stage\telements\theap-allocs\theap-bytes\tbuffer-allocs\tbuffer-bytes\tcopied-bytes\tcreated"
+           << std::endl;
+        for (auto &s : snapshot()) {
+            const MediaStageCounters &c = s.counters;
+            os << s.name << "\t" << c.elements << "\t" << c.heapAllocs << "\t" << c.heapBytes << "\t"
+               << c.bufferAllocs << "\t" << c.bufferBytes << "\t" << c.bufferCopiedBytes << "\t"
+               << c.elementsCreated << std::endl;
+        }
+    }
+
     virtual void input(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
         return inputHandlers_[index](mediaElement);
     }
@@ -84,8 +377,9 @@ class BaseMediaProcess: public MediaProcessInterface {
     }
 
     virtual void interrupt() {
-        auto it = mps_.rbegin();
-        auto itEnd = mps_.rend();
+        std::vector<std::shared_ptr<BaseMediaProcess> > mps = stages_();
+        auto it = mps.rbegin();
+        auto itEnd = mps.rend();
 
         while (it != itEnd) {
             it->get()->interrupt();
@@ -93,17 +387,181 @@ class BaseMediaProcess: public MediaProcessInterface {
         }
     }
 
+    // return when elements taken in have left, input is expected to be held by caller. queued stages
+    // override it, a composition drains its stages from the first level on. false if deadline passed.
+    virtual bool drain(const MediaStageStats::Clock::time_point &deadline = MediaStageStats::Clock::time_point::max()) {
+        bool drained = true;
+        for (auto &mp : stages_()) {
+            drained = mp->drain(deadline) && drained;
+        }
+        return drained;
+    }
+
+    // end of stream, input is expected to be stopped by caller. stages with threads drain what they
+    // took in, stop their threads and return true, or drop the rest and return false once deadline
+    // passed. a composition finishes its stages from the first level on, so each stage has got all
+    // its upstream sent before it finishes. a stage not drained in time is aborted with all after it,
+    // last first, so none stays blocked on a stage still running below.
+    virtual bool finish(const MediaStageStats::Clock::time_point &deadline) {
+        std::vector<std::shared_ptr<BaseMediaProcess> > mps = stages_();
+        bool drained = true;
+        for (size_t i = 0; i < mps.size(); ++i) {
+            if (mps[i]->drain(deadline)) {
+                drained = finishStage_(mps[i], deadline) && drained;
+                continue;
+            }
+            for (size_t j = mps.size(); j > i; --j) {
+                mps[j - 1]->abort();
+            }
+            for (size_t j = i; j < mps.size(); ++j) {
+                finishStage_(mps[j], deadline);
+            }
+            return false;
+        }
+        return drained;
+    }
+
+    // drop what is queued and release blocked input, threads are joined by finish.
+    virtual void abort() {
+        std::vector<std::shared_ptr<BaseMediaProcess> > mps = stages_();
+        for (auto it = mps.rbegin(); it != mps.rend(); ++it) {
+            (*it)->abort();
+        }
+    }
+
+    // index of the sub stage named so, kNone if none.
+    size_t stageIndex(const std::string &name) const {
+        std::unique_lock<MediaMutex> lock(layoutMutex_);
+        for (size_t i = 0; i < mps_.size(); ++i) {
+            if (mps_[i]->getName() == name) {
+                return i;
+            }
+        }
+        return MediaGraph::kNone;
+    }
+
+    std::shared_ptr<BaseMediaProcess> stage(const size_t &index) const {
+        std::unique_lock<MediaMutex> lock(layoutMutex_);
+        return mps_.at(index);
+    }
+
+    // swap sub stage at index while running, e.g. for new parameters or another implementation. edges
+    // into it pause, it drains to its outputs, the new stage takes over its edges and they resume, so
+    // no element is lost or seen twice and other edges keep flowing. the new stage has the same ports
+    // and is started by caller, the old one is returned drained, to be stopped by caller.
+    std::shared_ptr<BaseMediaProcess> replaceStage(const size_t &index, const std::shared_ptr<BaseMediaProcess> &mp) {
+        std::unique_lock<MediaMutex> rewire(rewireMutex_);
+        std::shared_ptr<BaseMediaProcess> old;
+        {
+            std::unique_lock<MediaMutex> lock(layoutMutex_);
+            old = mps_.at(index);
+            if (std::count(mps_.begin(), mps_.end(), old) != 1) {
+                throw std::runtime_error("stage composed more than once can not be replaced live.");
+            }
+        }
+        if (old->getInputCount() == 0) {
+            throw std::runtime_error("generator stage can not be replaced live.");
+        }
+        if (mp->getInputCount() != old->getInputCount() || mp->getOutputCount() != old->getOutputCount()) {
+            throw std::runtime_error("ports of replacing stage not match.");
+        }
+
+        std::vector<size_t> ins;
+        for (size_t k = 0; k < edges_.size(); ++k) {
+            if (edges_[k].to == index) {
+                ins.emplace_back(k);
+            }
+        }
+        for (auto k : ins) {
+            links_[k]->pause();
+        }
+        old->drain();
+
+        BaseMediaProcess *mpPtr = mp.get();
+        for (size_t k = 0; k < edges_.size(); ++k) {
+            if (edges_[k].from == index) {
+                std::shared_ptr<MediaLink> link = links_[k];
+                mp->setOutputHandler(edges_[k].fromPort, [link](std::shared_ptr<BaseMediaElement> me) -> void {
+                    (*link)(me);
+                });
+            }
+        }
+        for (auto k : ins) {
+            size_t port = edges_[k].toPort;
+            links_[k]->setTarget([mpPtr, port](std::shared_ptr<BaseMediaElement> me) -> void {
+                mpPtr->input_(port, me);
+            });
+        }
+        if (mp->getName().empty()) {
+            mp->setName(old->getName());
+        }
+        {
+            std::unique_lock<MediaMutex> lock(layoutMutex_);
+            mps_[index] = mp;
+            std::replace(mpsPrev_.begin(), mpsPrev_.end(), old, mp);
+        }
+
+        for (auto k : ins) {
+            links_[k]->resume();
+        }
+        return old;
+    }
+
+    // exchange where two outputs go while running, from is a sub stage index or kNone for input of this
+    // process. only the two edges pause, elements already passed stay where they went.
+    void swapTargets(const size_t &fromA, const size_t &portA, const size_t &fromB, const size_t &portB) {
+        std::unique_lock<MediaMutex> rewire(rewireMutex_);
+        size_t a = linkOf_(fromA, portA);
+        size_t b = linkOf_(fromB, portB);
+        if (a == b) {
+            return;
+        }
+        links_[a]->pause();
+        links_[b]->pause();
+        MediaLink::Handler target = links_[a]->getTarget();
+        links_[a]->setTarget(links_[b]->getTarget());
+        links_[b]->setTarget(target);
+        {
+            std::unique_lock<MediaMutex> lock(layoutMutex_);
+            std::swap(edges_[a].to, edges_[b].to);
+            std::swap(edges_[a].toPort, edges_[b].toPort);
+        }
+        links_[b]->resume();
+        links_[a]->resume();
+    }
+
  private:
+    // copy of mps_, to walk it out of layoutMutex_.
+    std::vector<std::shared_ptr<BaseMediaProcess> > stages_() const {
+        std::unique_lock<MediaMutex> lock(layoutMutex_);
+        return mps_;
+    }
+
+    // edge index of an output, under rewireMutex_.
+    size_t linkOf_(const size_t &from, const size_t &port) const {
+        for (size_t k = 0; k < edges_.size(); ++k) {
+            if (edges_[k].from == from && edges_[k].fromPort == port) {
+                return k;
+            }
+        }
+        throw std::runtime_error("no edge from " + std::to_string(from) + ":" + std::to_string(port) + ".");
+    }
+
+    // edge from, to, and the switchable link carrying it.
+    std::function<void(std::shared_ptr<BaseMediaElement>)> link_(const MediaGraph::Edge &edge,
+                                                                 const MediaLink::Handler &target) {
+        std::shared_ptr<MediaLink> link = std::make_shared<MediaLink>(target);
+        edges_.push_back(edge);
+        links_.emplace_back(link);
+        return [link](std::shared_ptr<BaseMediaElement> me) -> void {
+            (*link)(me);
+        };
+    }
+
     template <typename...Args>
     void init(size_t level, std::shared_ptr<BaseMediaProcess> mp, Args... args) {
         if (level == 0) {
-            // check if start with a generator
-            if (mp->getInputCount() == 0) {
-                BaseMediaProcess *mpPtr = mp.get();
-                generator_ = [mpPtr]() -> bool {
-                    return mpPtr->generate();
-                };
-            }
+            initSingle_(mp);
         }
         std::vector<std::shared_ptr<BaseMediaProcess> > mps({mp});
         return init(level, mps, args ...);
@@ -111,6 +569,26 @@ class BaseMediaProcess: public MediaProcessInterface {
 
     template <typename...Args>
     void init(size_t level, std::vector<std::shared_ptr<BaseMediaProcess> > mps, Args... args) {
+        initLevel_(level, mps);
+        return init(level+1, args...);
+    }
+
+    template <typename...Args>
+    void init(size_t level) {
+        initEnd_();
+    }
+
+    // check if start with a generator
+    void initSingle_(const std::shared_ptr<BaseMediaProcess> &mp) {
+        if (mp->getInputCount() == 0) {
+            BaseMediaProcess *mpPtr = mp.get();
+            generator_ = [mpPtr]() -> bool {
+                return mpPtr->generate_();
+            };
+        }
+    }
+
+    void initLevel_(size_t level, const std::vector<std::shared_ptr<BaseMediaProcess> > &mps) {
         if (level == 0) {
             // collect input
 
@@ -120,16 +598,26 @@ class BaseMediaProcess: public MediaProcessInterface {
                 BaseMediaProcess *mpPtr = mp.get();
                 size_t count = mp->getInputCount();
 
+                if (count == 0) {
+                    // every leading generator is a source of its own, runloop polls them all.
+                    generators_.emplace_back([mpPtr]() -> bool {
+                        return mpPtr->generate_();
+                    });
+                }
+
                 for (size_t i = 0; i < count; ++i) {
-                    inputHandlers_[inputCount_] = [mpPtr, i] (std::shared_ptr<BaseMediaElement> me) -> void {
-                        return mpPtr->input(i, me);
-                    };
+                    inputHandlers_[inputCount_] = link_({MediaGraph::kNone, inputCount_, mps_.size() - 1, i},
+                        [mpPtr, i] (std::shared_ptr<BaseMediaElement> me) -> void {
+                            return mpPtr->input_(i, me);
+                        });
                     ++inputCount_;
                 }
             }
         } else {
             // prev.output -> curr.input
             std::vector<std::function<void(std::shared_ptr<BaseMediaElement>)>> funcs;
+            // stage index and port of each func.
+            std::vector<std::pair<size_t, size_t> > ports;
             for (auto mp : mps) {
                 // hold it in memory
                 mps_.emplace_back(mp);
@@ -137,8 +625,9 @@ class BaseMediaProcess: public MediaProcessInterface {
                 size_t count = mp->getInputCount();
                 for (size_t i = 0; i < count; ++i) {
                     funcs.emplace_back([mpPtr, i](std::shared_ptr<BaseMediaElement> me) -> void {
-                        mpPtr->input(i, me);
+                        mpPtr->input_(i, me);
                     });
+                    ports.emplace_back(mps_.size() - 1, i);
                 }
             }
 
@@ -149,8 +638,9 @@ class BaseMediaProcess: public MediaProcessInterface {
             size_t j = 0;
             for (auto mp : mpsPrev_) {
                 size_t count = mp->getOutputCount();
+                size_t index = indexOf_(mp);
                 for (size_t i = 0; i < count; ++i) {
-                    mp->setOutputHandler(i, funcs[j]);
+                    mp->setOutputHandler(i, link_({index, i, ports[j].first, ports[j].second}, funcs[j]));
                     ++j;
                 }
             }
@@ -163,29 +653,146 @@ class BaseMediaProcess: public MediaProcessInterface {
             mpsPrev_.emplace_back(mp);
             prevOutputCount_ += mp->getOutputCount();
         }
-        return init(level+1, args...);
     }
 
-    template <typename...Args>
-    void init(size_t level) {
+    void initEnd_() {
         // last
         size_t j = 0;
         for (auto mp : mpsPrev_) {
             size_t count = mp->getOutputCount();
+            size_t index = indexOf_(mp);
             outputCount_ += count;
             for (size_t i = 0; i < count; ++i) {
-                mp->setOutputHandler(i, [this, j](std::shared_ptr<BaseMediaElement> me) -> void {
-                    if (this->outputHandlers_.find(j) != this->outputHandlers_.end()) {
-                        this->outputHandlers_[j](me);
-                    }
-                });
+                mp->setOutputHandler(i, link_({index, i, MediaGraph::kNone, j},
+                    [this, j](std::shared_ptr<BaseMediaElement> me) -> void {
+                        if (this->outputHandlers_.find(j) != this->outputHandlers_.end()) {
+                            this->outputHandlers_[j](me);
+                        }
+                    }));
                 ++j;
             }
         }
     }
 
+    // input with stats, time is not recorded for async input, it is recorded by worker.
+    void input_(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
+        bool stats = MediaStageStats::enabled();
+        bool trace = MediaTracer::instance().enabled();
+        if (stats) {
+            stats_.recordElement(mediaElement->getMediaBufferBytes());
+        }
+        if (asyncInput_ || (!stats && !trace)) {
+            return input(index, mediaElement);
+        }
+
+        MediaStageTimer timer(stats ? &stats_ : nullptr);
+        input(index, mediaElement);
+        timer.stop();
+        if (trace) {
+            MediaTracer::instance().record(traceNameId_(), mediaElement->id(), timer.begin(), timer.stop());
+        }
+    }
+
+    bool generate_() {
+        bool stats = MediaStageStats::enabled();
+        bool trace = MediaTracer::instance().enabled();
+        if (!stats && !trace) {
+            return generate();
+        }
+
+        MediaStageTimer timer(stats ? &stats_ : nullptr);
+        bool more = generate();
+        timer.stop();
+        if (trace) {
+            MediaTracer::instance().record(traceNameId_(), 0, timer.begin(), timer.stop());
+        }
+        return more;
+    }
+
+    // name or class name.
+    std::string displayName_() const {
+        return name_.empty() ? className_() : name_;
+    }
+
+    std::string className_() const {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(typeid(*this).name(), nullptr, nullptr, &status);
+        std::string name = status == 0 ? demangled : typeid(*this).name();
+        free(demangled);
+        return name;
+    }
+
+    // last index in mps_, a process may be composed more than once.
+    size_t indexOf_(const std::shared_ptr<BaseMediaProcess> &mp) const {
+        for (size_t i = mps_.size(); i > 0; --i) {
+            if (mps_[i - 1] == mp) {
+                return i - 1;
+            }
+        }
+        return MediaGraph::kNone;
+    }
+
+    // return index of this stage in graph.
+    size_t graph_(const std::string &path, const size_t &parent, MediaGraph &graph) const {
+        size_t self = graph.stages.size();
+        MediaStageSnapshot snapshot;
+        snapshot.name = path;
+        snapshot.className = className_();
+        snapshot.type = getType();
+        snapshot.inputCount = getInputCount();
+        snapshot.outputCount = getOutputCount();
+        snapshot.counters = stats_.read();
+        snapshot.hasQueue = readGauges_(snapshot.queue);
+        graph.stages.emplace_back(snapshot);
+        graph.parents.emplace_back(parent);
+
+        std::unique_lock<MediaMutex> lock(layoutMutex_);
+        std::vector<size_t> indexes;
+        for (size_t i = 0; i < mps_.size(); ++i) {
+            const std::string &name = mps_[i]->getName();
+            indexes.emplace_back(mps_[i]->graph_(path + "/" + (name.empty() ? std::to_string(i) : name), self, graph));
+        }
+        for (auto &e : edges_) {
+            graph.edges.push_back({e.from == MediaGraph::kNone ? self : indexes[e.from], e.fromPort,
+                                   e.to == MediaGraph::kNone ? self : indexes[e.to], e.toPort});
+        }
+        return self;
+    }
 
  protected:
+    // a stage failing to finish counts as not drained, the rest still finish.
+    bool finishStage_(const std::shared_ptr<BaseMediaProcess> &mp, const MediaStageStats::Clock::time_point &deadline) {
+        try {
+            return mp->finish(deadline);
+        } catch (const std::exception &e) {
+            if (!errorHandler_ || !errorHandler_(e)) {
+                std::cerr << "finish error: " << e.what() << std::endl;
+            }
+            return false;
+        }
+    }
+
+    // wait step of drain, short so no chrono overflows for a far deadline.
+    static boost::chrono::nanoseconds drainWait_(const MediaStageStats::Clock::time_point &deadline) {
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            deadline - MediaStageStats::Clock::now()).count();
+        return boost::chrono::nanoseconds(std::max<int64_t>(std::min<int64_t>(ns, 100000000), 0));
+    }
+
+    // stages with a queue report its gauges in snapshot.
+    virtual bool readGauges_(MediaQueueGauges &gauges) const {
+        return false;
+    }
+
+    uint32_t traceNameId_() {
+        int64_t id = traceNameId__.load(std::memory_order_relaxed);
+        if (id < 0) {
+            id = MediaTracer::instance().intern(displayName_());
+            traceNameId__.store(id, std::memory_order_relaxed);
+        }
+        return static_cast<uint32_t>(id);
+    }
+
     size_t inputCount_ = 0;
     size_t outputCount_ = 0;
 
@@ -194,6 +801,14 @@ class BaseMediaProcess: public MediaProcessInterface {
     size_t prevOutputCount_ = 0;
 
     std::vector<std::shared_ptr<BaseMediaProcess> > mps_;
+    // set by init, stage index in mps_, kNone for this process itself.
+    std::vector<MediaGraph::Edge> edges_;
+    // carrying edges_, same index.
+    std::vector<std::shared_ptr<MediaLink> > links_;
+    // mps_ and edges_ changed while running are read under it.
+    mutable MediaMutex layoutMutex_ MEDIA_LOCK_SITE("BaseMediaProcess::layoutMutex_");
+    // one rewiring at a time.
+    MediaMutex rewireMutex_ MEDIA_LOCK_SITE("BaseMediaProcess::rewireMutex_");
 
     std::function<bool(const std::exception &)> errorHandler_;
     std::map<size_t, std::function<void(std::shared_ptr<BaseMediaElement>)> > outputHandlers_;
@@ -204,6 +819,19 @@ class BaseMediaProcess: public MediaProcessInterface {
     // generator proxy
     std::function<bool()> generator_;
 
+    // all generators of level 0, in order.
+    std::vector<std::function<bool()> > generators_;
+
+    MediaPlacement placement_;
+
+    std::string name_;
+    MediaStageStats stats_;
+    // input only queue the element, process time is recorded by the stage itself.
+    bool asyncInput_ = false;
+
+ private:
+    std::atomic<int64_t> traceNameId__{-1};
+
 };
 
 
@@ -331,64 +959,455 @@ public:
 
     template <typename...Args>
     BaseMediaProcessRunloop(Args...args): BaseMediaProcess(args...) {
-        assert(getInputCount() == 0);
-        assert(getOutputCount() == 0);
+        addSources_();
+    }
+
+    explicit BaseMediaProcessRunloop(const MediaProcessLevels &levels): BaseMediaProcess(levels) {
+        if (getInputCount() != 0 || getOutputCount() != 0) {
+            throw std::runtime_error("runloop must start with generators and end with collapsars.");
+        }
+        addSources_();
     }
 
     virtual const MediaProcessType getType() const {
         return MediaProcessTypeRunloop;
     }
 
+    // add a source polled by this runloop, return its id. source can be added while running.
+    size_t addSource(std::function<bool()> generator) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        std::shared_ptr<Source> source = std::make_shared<Source>();
+        source->id = nextSourceId_++;
+        source->generate = generator;
+        sources_.emplace_back(source);
+        ++activeSources_;
+        sourceCond_.notify_one();
+        std::function<void()> readyHandler = takeReadyHandler_();
+        lock.unlock();
+        if (readyHandler) {
+            readyHandler();
+        }
+        return source->id;
+    }
+
+    // add a generator whose output handlers are already set by caller.
+    size_t addSource(const std::shared_ptr<BaseMediaProcess> &mp) {
+        if (mp->getInputCount() != 0) {
+            throw std::runtime_error("source must be a generator.");
+        }
+
+        BaseMediaProcess *mpPtr = mp.get();
+        {
+            std::unique_lock<MediaMutex> lock(layoutMutex_);
+            // hold it in memory.
+            mps_.emplace_back(mp);
+        }
+        return addSource([mpPtr]() -> bool {
+            return mpPtr->generate();
+        });
+    }
+
+    // drop a source and its generator, e.g. from the eos handler once it ended. the generate in progress
+    // is not interrupted, its generator is released when it returns. later calls on the id are ignored.
+    void removeSource(const size_t &id) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        for (size_t i = 0; i < sources_.size(); ++i) {
+            std::shared_ptr<Source> source = sources_[i];
+            if (source->id != id) {
+                continue;
+            }
+            if (!source->ended) {
+                source->ended = true;
+                if (--activeSources_ == 0 && !keepAlive_) {
+                    running_ = false;
+                    sourceCond_.notify_all();
+                }
+            }
+            if (!source->busy) {
+                source->generate = nullptr;
+            }
+            sources_.erase(sources_.begin() + i);
+            if (next_ > i) {
+                --next_;
+            }
+            if (next_ >= sources_.size()) {
+                next_ = 0;
+            }
+            break;
+        }
+    }
+
+    size_t getSourceCount() {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        return sources_.size();
+    }
+
+    // paused source is skipped till resumed, the generate in progress is not interrupted.
+    void pause(const size_t &id) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        std::shared_ptr<Source> source = findSource_(id);
+        if (source) {
+            source->paused = true;
+        }
+    }
+
+    void resume(const size_t &id) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        std::shared_ptr<Source> source = findSource_(id);
+        if (!source) {
+            return;
+        }
+        source->paused = false;
+        sourceCond_.notify_one();
+        std::function<void()> readyHandler = takeReadyHandler_();
+        lock.unlock();
+        if (readyHandler) {
+            readyHandler();
+        }
+    }
+
+    // a removed source counts as ended.
+    bool isEnded(const size_t &id) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        std::shared_ptr<Source> source = findSource_(id);
+        return !source || source->ended;
+    }
+
+    // called once for each source when its generate return false.
+    void setEndOfStreamHandler(std::function<void(size_t)> eosHandler) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        eosHandler_ = eosHandler;
+    }
+
+    // threads sharing all sources, take effect on next start.
+    void setThreadCount(const size_t &count) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        threadCount_ = count ? count : 1;
+    }
+
+    // keep running while no source remain, sources can be added later.
+    void setKeepAlive(bool keepAlive) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        keepAlive_ = keepAlive;
+        sourceCond_.notify_all();
+    }
+
+    // called once, out of runloop lock, when a source may be ready or all ended after step returned
+    // MediaRunloopStepIdle, so the driving loop need not poll an idle runloop.
+    void setReadyHandler(std::function<void()> readyHandler) {
+        std::unique_lock<MediaMutex> lock(mutex_);
+        readyHandler_ = readyHandler;
+    }
+
+    // generate once on next ready source without blocking, so another loop can drive this one.
+    virtual MediaRunloopStep step() {
+        std::shared_ptr<Source> source;
+        {
+            std::unique_lock<MediaMutex> lock(mutex_);
+            if (stopping_) {
+                return MediaRunloopStepEnded;
+            }
+            if (nextSourceId_ == 0) {
+                lock.unlock();
+                return generate() ? MediaRunloopStepGenerated : MediaRunloopStepEnded;
+            }
+            if (activeSources_ == 0) {
+                return MediaRunloopStepEnded;
+            }
+            source = pickSource_(lock, false);
+            if (!source) {
+                // all paused or busy.
+                readyWanted_ = true;
+                return MediaRunloopStepIdle;
+            }
+            source->busy = true;
+            ++generating_;
+        }
+
+        generateSource_(source);
+        return MediaRunloopStepGenerated;
+    }
+
     virtual void run() {
         {
-            std::unique_lock<std::mutex> lock(mutex_);
-            running_ = true;
+            std::unique_lock<MediaMutex> lock(mutex_);
+            // start set them already, a stop since then holds.
+            if (!starting_) {
+                running_ = true;
+                stopping_ = false;
+            }
+            starting_ = false;
+            sourceCond_.notify_all();
         }
+        placement_.apply();
 
-        while (running_ && generate()) {
+        if (nextSourceId_ == 0 && !keepAlive_) {
+            while (running_ && generate()) {
+            }
+        } else {
+            std::vector<std::thread> helpers;
+            for (size_t i = 1; i < threadCount_; ++i) {
+                helpers.emplace_back([this]() {
+                    placement_.apply();
+                    runSources_();
+                });
+            }
+
+            runSources_();
+
+            for (auto &t : helpers) {
+                if (t.joinable()) {
+                    t.join();
+                }
+            }
         }
 
+#ifdef MEDIA_ALLOC_PROFILE
+        // report per run in profiling build.
+        writeAllocReport(std::cout);
+#endif
+#ifdef MEDIA_LOCK_PROFILE
+        // lock sites are shared by all stages, so the report covers the whole process.
+        MediaLockProfile::write(std::cout);
+#endif
+
         {
-            std::unique_lock<std::mutex> lock(mutex_);
+            std::unique_lock<MediaMutex> lock(mutex_);
             running_ = false;
         }
     }
 
 
     virtual void start() {
-        std::unique_lock<std::mutex> lock(mutex_);
+        std::unique_lock<MediaMutex> lock(mutex_);
         if (!running_) {
-            std::thread t(&BaseMediaProcessRunloop::run, this);
+            if (proc_.joinable()) {
+                // last run ended by itself.
+                lock.unlock();
+                proc_.join();
+                lock.lock();
+            }
+            // running before the thread does, so stop right after start will not be missed, and a
+            // derived run need not signal it.
+            running_ = true;
+            stopping_ = false;
+            starting_ = true;
+            std::thread t([this]() {
+                run();
+                std::unique_lock<MediaMutex> lock(mutex_);
+                starting_ = false;
+                running_ = false;
+            });
             proc_.swap(t);
         }
     }
 
+    // stop at once, generate and input in progress are interrupted, elements queued in stages stay.
     virtual void stop() {
+        bool running;
         {
-            std::unique_lock<std::mutex> lock(mutex_);
-            if (!running_) {
-                return;
-            } else {
-                running_ = false;
-            }
+            std::unique_lock<MediaMutex> lock(mutex_);
+            running = running_;
+            running_ = false;
+            sourceCond_.notify_all();
         }
 
-        interrupt();
-        if (proc_.joinable()) {
+        if (running) {
+            interrupt();
+        }
+        if (proc_.joinable() && proc_.get_id() != std::this_thread::get_id()) {
             proc_.join();
         }
     }
 
+    // stop without losing elements: sources stop after the generate in progress, then stages finish
+    // from the first level on, each passing on all it took in before the next one finishes. a generate
+    // still blocking at half the timeout is interrupted, stages not drained at the timeout drop the
+    // rest. also ends a runloop driven by step(). return true if nothing was dropped.
+    bool shutdown(const size_t timeoutMs = 5000) {
+        MediaStageStats::Clock::time_point begin = MediaStageStats::Clock::now();
+        MediaStageStats::Clock::time_point deadline = begin + std::chrono::milliseconds(timeoutMs);
+        bool drained = true;
+        {
+            std::unique_lock<MediaMutex> lock(mutex_);
+            running_ = false;
+            stopping_ = true;
+            sourceCond_.notify_all();
+            // blocked generate is interrupted with time left to drain what it produced.
+            MediaStageStats::Clock::time_point interruptAt = begin + std::chrono::milliseconds(timeoutMs / 2);
+            while (generating_ > 0 && sourceCond_.wait_until(lock, interruptAt) != std::cv_status::timeout) {
+            }
+            if (generating_ > 0) {
+                drained = false;
+            }
+        }
+        if (!drained) {
+            interrupt();
+        }
+        // a generate blocked on a full stage is released when that stage is aborted.
+        drained = finish(deadline) && drained;
+        if (proc_.joinable() && proc_.get_id() != std::this_thread::get_id()) {
+            proc_.join();
+        }
+        return drained;
+    }
+
 protected:
-    std::mutex mutex_;
+    struct Source {
+        size_t id = 0;
+        std::function<bool()> generate;
+        bool paused = false;
+        bool ended = false;
+        // being generated by some thread.
+        bool busy = false;
+    };
+
+    MediaMutex mutex_ MEDIA_LOCK_SITE("BaseMediaProcessRunloop::mutex_");
     std::thread proc_;
     bool running_  = false;
+
+private:
+    void addSources_() {
+        assert(getInputCount() == 0);
+        assert(getOutputCount() == 0);
+
+        if (generator_ && generators_.size() == 1) {
+            // single source keeps going through generate(), derived class may override it.
+            addSource([this]() -> bool {
+                return this->generate();
+            });
+        } else {
+            for (auto &g : generators_) {
+                addSource(g);
+            }
+        }
+    }
+
+    // round robin from the one after last picked, nullptr means exit or nothing ready if not block.
+    std::shared_ptr<Source> pickSource_(std::unique_lock<MediaMutex> &lock, bool block = true) {
+        while (running_ || !block) {
+            size_t count = sources_.size();
+            for (size_t i = 0; i < count; ++i) {
+                std::shared_ptr<Source> &source = sources_[(next_ + i) % count];
+                if (!source->paused && !source->ended && !source->busy) {
+                    next_ = (next_ + i + 1) % count;
+                    return source;
+                }
+            }
+            if (!block || (activeSources_ == 0 && !keepAlive_)) {
+                break;
+            }
+            sourceCond_.wait(lock);
+        }
+        return nullptr;
+    }
+
+    void generateSource_(const std::shared_ptr<Source> &source) {
+        bool more = false;
+        try {
+            more = source->generate();
+        } catch (const std::exception &e) {
+            if (!errorHandler_) {
+                std::unique_lock<MediaMutex> lock(mutex_);
+                source->busy = false;
+                --generating_;
+                sourceCond_.notify_all();
+                throw;
+            }
+            more = errorHandler_(e);
+        }
+
+        std::function<void(size_t)> eosHandler;
+        std::function<void()> readyHandler;
+        {
+            std::unique_lock<MediaMutex> lock(mutex_);
+            source->busy = false;
+            readyHandler = takeReadyHandler_();
+            if (--generating_ == 0 && stopping_) {
+                // shutdown waits generates in progress.
+                sourceCond_.notify_all();
+            }
+            // a source removed meanwhile has ended already.
+            if (!more && !source->ended) {
+                source->ended = true;
+                eosHandler = eosHandler_;
+                if (--activeSources_ == 0 && !keepAlive_) {
+                    // all sources end, wake up others to exit.
+                    running_ = false;
+                    sourceCond_.notify_all();
+                }
+            }
+            sourceCond_.notify_one();
+        }
+
+        if (eosHandler) {
+            eosHandler(source->id);
+        }
+        if (readyHandler) {
+            readyHandler();
+        }
+    }
+
+    // lock held, nullptr if removed.
+    std::shared_ptr<Source> findSource_(const size_t &id) {
+        for (auto &source : sources_) {
+            if (source->id == id) {
+                return source;
+            }
+        }
+        return nullptr;
+    }
+
+    // lock held, handler if a step is waiting for it.
+    std::function<void()> takeReadyHandler_() {
+        if (!readyWanted_) {
+            return nullptr;
+        }
+        readyWanted_ = false;
+        return readyHandler_;
+    }
+
+    void runSources_() {
+        while (true) {
+            std::shared_ptr<Source> source;
+            {
+                std::unique_lock<MediaMutex> lock(mutex_);
+                source = pickSource_(lock);
+                if (!source) {
+                    break;
+                }
+                source->busy = true;
+                ++generating_;
+            }
+
+            generateSource_(source);
+        }
+    }
+
+    MediaCondition sourceCond_;
+    std::vector<std::shared_ptr<Source> > sources_;
+    size_t activeSources_ = 0;
+    // ids are not reused, so a removed one stays unknown.
+    size_t nextSourceId_ = 0;
+    size_t next_ = 0;
+    size_t threadCount_ = 1;
+    // run of start not begun yet.
+    bool starting_ = false;
+    // generates in progress, and shutdown asked.
+    size_t generating_ = 0;
+    bool stopping_ = false;
+    bool keepAlive_ = false;
+    std::function<void(size_t)> eosHandler_;
+    // a step found nothing ready.
+    bool readyWanted_ = false;
+    std::function<void()> readyHandler_;
 };
 
 
 class BaseMediaProcessThreadedPipe : public BaseMediaProcessPipe {
 public:
     explicit BaseMediaProcessThreadedPipe(const uint8_t count = 1) : count_(count) {
+        asyncInput_ = true;
     }
 
     ~BaseMediaProcessThreadedPipe() {
@@ -405,14 +1424,31 @@ public:
     }
 
     virtual void input(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
-        boost::unique_lock<boost::mutex> lock(mutex_);
+        MediaDeadlineExecutor::Clock::time_point deadline = mediaElement->getDeadline();
+        if (MediaDeadlineExecutor::expired(deadline)) {
+            // drop early
+            ++missCount_;
+            return;
+        }
+
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        if (executor_) {
+            return submit_(lock, deadline, mediaElement);
+        }
+
         while (running_) {
             if (me_) {
+                // all workers busy and input blocked, try one more worker.
+                scaleUp_();
                 // wait out event
+                MediaStageStats::Clock::time_point begin = MediaStageStats::Clock::now();
                 meCondOut_.wait(lock);
+                inputBlockedNs_ += MediaStageStats::since(begin);
             }
             if ((!me_) && running_) {
                 me_ = mediaElement;
+                meInTime_ = MediaStageStats::Clock::now();
+                updateDepth_();
                 meCondIn_.notify_one();
                 return;
             }
@@ -423,29 +1459,110 @@ public:
         throw std::runtime_error("not impl.");
     }
 
+    // run on a shared executor instead of own threads, count is the max in-flight elements then.
+    // take effect on next start.
+    void setExecutor(const std::shared_ptr<MediaDeadlineExecutor> &executor) {
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        executor_ = executor;
+    }
+
+    // elements dropped for their deadline passed.
+    const size_t deadlineMissCount() const {
+        return missCount_.load();
+    }
+
+    // worker threads, applied at once while running: workers are added, or the extra ones retire once
+    // idle, elements are neither dropped nor repeated. with executor it bounds elements in flight.
+    // with auto scale it is kept till disableAutoScale.
+    void setThreadCount(const size_t count) {
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        count_ = static_cast<uint8_t>(std::min<size_t>(std::max<size_t>(count, 1), UINT8_MAX));
+        if (!autoScale_) {
+            applyWorkers_();
+        }
+    }
+
+    // start with minCount workers, add one when input blocked while all busy, up to maxCount.
+    // worker idle for idleTimeoutMs retires, down to minCount. applied at once while running as
+    // setThreadCount is, and called again to change the bounds. not used with executor.
+    void setAutoScale(const size_t minCount, const size_t maxCount, const size_t idleTimeoutMs = 1000) {
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        autoScale_ = true;
+        minCount_ = minCount ? minCount : 1;
+        maxCount_ = std::max(minCount_, maxCount);
+        idleTimeoutMs_ = idleTimeoutMs;
+        applyWorkers_();
+    }
+
+    // back to the workers of setThreadCount, applied at once while running.
+    void disableAutoScale() {
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        autoScale_ = false;
+        applyWorkers_();
+    }
+
+    // live worker threads.
+    const size_t getWorkerCount() {
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        return workers_;
+    }
+
+    // moving average of process time, in nanoseconds.
+    const int64_t getProcessTime() {
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        return processNs_;
+    }
+
+    // queue depth is the waiting element plus elements in executor.
+    MediaQueueGauges getGauges() const {
+        MediaQueueGauges gauges;
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        depth_.readInto(gauges);
+        gauges.inputBlockedNs = inputBlockedNs_;
+        gauges.idleNs = idleNs_;
+        gauges.workers = executor_ ? inflight_ : workers_;
+        gauges.deadlineMisses = missCount_.load();
+        return gauges;
+    }
+
     virtual void start() {
         reset();
-        boost::unique_lock<boost::mutex> lock(mutex_);
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
         running_ = true;
-        for (uint8_t i = 0; i < count_; ++i) {
+        depth_.reset();
+        inputBlockedNs_ = 0;
+        idleNs_ = 0;
+        if (executor_) {
+            return;
+        }
+        size_t count = autoScale_ ? minCount_ : count_;
+        for (size_t i = 0; i < count; ++i) {
             threads_.emplace_back(&BaseMediaProcessThreadedPipe::run_, this);
         }
+        workers_ = count;
     }
 
     virtual void stop(bool graceful = true) {
-        boost::unique_lock<boost::mutex> lock(mutex_);
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
         stopGraceful_ = graceful;
         running_ = false;
         cond_.notify_all();
         meCondOut_.notify_all();
         meCondIn_.notify_all();
+        drainCond_.notify_all();
     }
 
     virtual void wait() {
         std::vector<boost::thread> ts;
         {
-            boost::unique_lock<boost::mutex> lock(mutex_);
+            boost::unique_lock<MediaBoostMutex> lock(mutex_);
             ts.swap(threads_);
+            retired_.clear();
+
+            // work on executor hold this.
+            while (inflight_ > 0) {
+                meCondOut_.wait(lock);
+            }
         }
 
         std::vector<boost::thread>::iterator tEnd = ts.end();
@@ -458,55 +1575,260 @@ public:
         }
     }
 
+    // wait till no element is waiting or being processed, input is held by caller.
+    virtual bool drain(const MediaStageStats::Clock::time_point &deadline = MediaStageStats::Clock::time_point::max()) {
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        ++drainers_;
+        while (running_ && (me_ || busy_ > 0 || inflight_ > 0) && MediaStageStats::Clock::now() < deadline) {
+            drainCond_.wait_for(lock, drainWait_(deadline));
+        }
+        --drainers_;
+        return !(me_ || busy_ > 0 || inflight_ > 0);
+    }
+
+    virtual bool finish(const MediaStageStats::Clock::time_point &deadline) {
+        bool drained = drain(deadline);
+        stop(drained);
+        wait();
+        return drained;
+    }
+
+    virtual void abort() {
+        stop(false);
+    }
+
     virtual void reset() {
         stop(true);
         wait();
 
         assert(threads_.empty());
-        boost::unique_lock<boost::mutex> lock(mutex_);
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
         me_ = nullptr;
         meCondOut_.notify_one();
     }
 
 private:
+    void submit_(boost::unique_lock<MediaBoostMutex> &lock, const MediaDeadlineExecutor::Clock::time_point &deadline,
+                 const std::shared_ptr<BaseMediaElement> &mediaElement) {
+        // keep at most count_ elements in executor, as own threads do.
+        while (running_ && inflight_ >= count_) {
+            MediaStageStats::Clock::time_point begin = MediaStageStats::Clock::now();
+            meCondOut_.wait(lock);
+            inputBlockedNs_ += MediaStageStats::since(begin);
+        }
+        if (!running_) {
+            return;
+        }
+        ++inflight_;
+        updateDepth_();
+        std::shared_ptr<MediaDeadlineExecutor> executor = executor_;
+        lock.unlock();
+
+        MediaStageStats::Clock::time_point inTime = MediaStageStats::Clock::now();
+        bool submitted = executor->submit(deadline, [this, mediaElement, inTime]() {
+            // not graceful stop drop the pending.
+            if (running_ || stopGraceful_) {
+                MediaMemoryAccountScope account(mediaElement->account());
+                bool enabled = MediaStageStats::enabled();
+                MediaStageTimer timer(enabled ? &stats_ : nullptr);
+                if (enabled) {
+                    stats_.recordWait(std::chrono::duration_cast<std::chrono::nanoseconds>(timer.begin() - inTime).count());
+                }
+                process(mediaElement);
+                timer.stop();
+                if (MediaTracer::instance().enabled()) {
+                    MediaTracer::instance().record(traceNameId_(), mediaElement->id(), timer.begin(), timer.stop());
+                }
+
+                std::unique_lock<MediaMutex> lock(postRunMutex_);
+                if (outputHandlers_.find(0) != outputHandlers_.end()) {
+                    outputHandlers_[0](mediaElement);
+                }
+            }
+            done_();
+        }, [this]() {
+            ++missCount_;
+            done_();
+        });
+        if (!submitted) {
+            // executor stopped before the stage, the element is dropped.
+            done_();
+        }
+    }
+
+    void done_() {
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        --inflight_;
+        updateDepth_();
+        meCondOut_.notify_all();
+        notifyDrain_();
+    }
+
+    // under mutex_, after busy_ or inflight_ drop.
+    void notifyDrain_() {
+        if (drainers_ > 0) {
+            drainCond_.notify_all();
+        }
+    }
+
+    // under mutex_, join workers retired by themselves.
+    void joinRetired_() {
+        for (auto id : retired_) {
+            for (auto t = threads_.begin(); t != threads_.end(); ++t) {
+                if (t->get_id() == id) {
+                    t->join();
+                    threads_.erase(t);
+                    break;
+                }
+            }
+        }
+        retired_.clear();
+    }
+
+    // under mutex_.
+    void updateDepth_() {
+        depth_.set((me_ ? 1 : 0) + inflight_);
+    }
+
+    // under mutex_. workers are added up to the count, or the least of auto scale, those over the
+    // count, or the most of auto scale, retire once idle.
+    void applyWorkers_() {
+        if (!running_) {
+            return;
+        }
+        if (executor_) {
+            meCondOut_.notify_all();
+            return;
+        }
+        joinRetired_();
+        while (workers_ < (autoScale_ ? minCount_ : count_)) {
+            threads_.emplace_back(&BaseMediaProcessThreadedPipe::run_, this);
+            ++workers_;
+        }
+        // idle ones see they are too many.
+        meCondIn_.notify_all();
+    }
+
+    // under mutex_.
+    void scaleUp_() {
+        if (!autoScale_ || !running_ || busy_ < workers_ || workers_ >= maxCount_) {
+            return;
+        }
+
+        // one worker per process time at most, a new worker need that long to show its effect.
+        boost::chrono::steady_clock::time_point now = boost::chrono::steady_clock::now();
+        if (now - lastScaleUp_ < boost::chrono::nanoseconds(processNs_)) {
+            return;
+        }
+        lastScaleUp_ = now;
+
+        // join retired workers before adding.
+        joinRetired_();
+
+        threads_.emplace_back(&BaseMediaProcessThreadedPipe::run_, this);
+        ++workers_;
+    }
+
     void run_() {
+        placement_.apply();
         while (running_) {
             std::shared_ptr<BaseMediaElement> currMe(nullptr);
             // try pick a media-element from input.
             {
-                boost::unique_lock<boost::mutex> lock(mutex_);
+                boost::unique_lock<MediaBoostMutex> lock(mutex_);
+                if (!me_ && workers_ > (autoScale_ ? maxCount_ : count_)) {
+                    // thread count or auto scale bounds lowered.
+                    --workers_;
+                    retired_.emplace_back(boost::this_thread::get_id());
+                    return;
+                }
                 if (!me_) {
-                    meCondIn_.wait(lock);
+                    MediaStageStats::Clock::time_point begin = MediaStageStats::Clock::now();
+                    if (autoScale_) {
+                        bool timeout = meCondIn_.wait_for(lock, boost::chrono::milliseconds(idleTimeoutMs_)) ==
+                            boost::cv_status::timeout;
+                        idleNs_ += MediaStageStats::since(begin);
+                        if (timeout && !me_ && running_ && workers_ > minCount_) {
+                            // idle too long, retire.
+                            --workers_;
+                            retired_.emplace_back(boost::this_thread::get_id());
+                            return;
+                        }
+                    } else {
+                        meCondIn_.wait(lock);
+                        idleNs_ += MediaStageStats::since(begin);
+                    }
                 }
 
                 if (running_ && me_) {
                     me_.swap(currMe);
+                    updateDepth_();
+                    ++busy_;
                     meCondOut_.notify_one();
+                    if (MediaStageStats::enabled()) {
+                        stats_.recordWait(MediaStageStats::since(meInTime_));
+                    }
                 }
             }
 
-            // run with post operation
-            if (running_ && currMe) {
-                process(currMe);
+            if (!currMe) {
+                continue;
+            }
 
-                // post output operation is single-thread.
-                std::unique_lock<std::mutex> lock(postRunMutex_);
-                if (running_) {
-                    if (outputHandlers_.find(0) != outputHandlers_.end()) {
-                        outputHandlers_[0](currMe);
-                    }
-                }
+            if (MediaDeadlineExecutor::expired(currMe->getDeadline())) {
+                ++missCount_;
+                boost::unique_lock<MediaBoostMutex> lock(mutex_);
+                --busy_;
+                notifyDrain_();
+                continue;
+            }
+
+            // graceful stop lets the picked element finish.
+            if (running_ || stopGraceful_) {
+                processOne_(currMe);
             }
+
+            boost::unique_lock<MediaBoostMutex> lock(mutex_);
+            --busy_;
+            notifyDrain_();
         }
 
-        // last call for graceful exit.
-        std::unique_lock<std::mutex> lock(postRunMutex_);
-        if (stopGraceful_) {
-            if (me_) {
-                if (outputHandlers_.find(0) != outputHandlers_.end()) {
-                    outputHandlers_[0](me_);
-                }
-                me_ = nullptr;
+        // last call for graceful exit, the element still waiting is processed by one of the workers.
+        std::shared_ptr<BaseMediaElement> lastMe;
+        {
+            boost::unique_lock<MediaBoostMutex> lock(mutex_);
+            --workers_;
+            if (stopGraceful_ && me_) {
+                me_.swap(lastMe);
+                updateDepth_();
+                meCondOut_.notify_all();
+            }
+        }
+        if (lastMe) {
+            processOne_(lastMe);
+        }
+    }
+
+    // run with post operation.
+    void processOne_(const std::shared_ptr<BaseMediaElement> &currMe) {
+        MediaMemoryAccountScope account(currMe->account());
+        MediaStageTimer timer(MediaStageStats::enabled() ? &stats_ : nullptr);
+        process(currMe);
+        MediaStageStats::Clock::time_point end = timer.stop();
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - timer.begin()).count();
+        {
+            boost::unique_lock<MediaBoostMutex> lock(mutex_);
+            processNs_ = processNs_ ? (processNs_ * 7 + ns) / 8 : ns;
+        }
+        if (MediaTracer::instance().enabled()) {
+            MediaTracer::instance().record(traceNameId_(), currMe->id(), timer.begin(), end);
+        }
+
+        // post output operation is single-thread, dropped if stopped not graceful meanwhile.
+        std::unique_lock<MediaMutex> lock(postRunMutex_);
+        if (running_ || stopGraceful_) {
+            if (outputHandlers_.find(0) != outputHandlers_.end()) {
+                outputHandlers_[0](currMe);
             }
         }
     }
@@ -518,21 +1840,48 @@ protected:
     uint8_t count_;
 
     // global mutex
-    boost::mutex mutex_;
+    mutable MediaBoostMutex mutex_ MEDIA_LOCK_SITE("BaseMediaProcessThreadedPipe::mutex_");
 
     // can using wait for interrupt
-    boost::condition_variable cond_;
+    MediaBoostCondition cond_;
+
+    virtual bool readGauges_(MediaQueueGauges &gauges) const {
+        gauges = getGauges();
+        return true;
+    }
 
 private:
-    boost::condition_variable meCondIn_;
-    boost::condition_variable meCondOut_;
+    MediaBoostCondition meCondIn_;
+    MediaBoostCondition meCondOut_;
+    MediaBoostCondition drainCond_;
+    size_t drainers_ = 0;
     std::shared_ptr<BaseMediaElement> me_ = nullptr;
+    MediaStageStats::Clock::time_point meInTime_;
+
+    // gauges, under mutex_.
+    MediaDepthGauge depth_;
+    uint64_t inputBlockedNs_ = 0;
+    uint64_t idleNs_ = 0;
 
     std::vector<boost::thread> threads_;
 
-    std::mutex postRunMutex_;
+    MediaMutex postRunMutex_ MEDIA_LOCK_SITE("BaseMediaProcessThreadedPipe::postRunMutex_");
 
     bool stopGraceful_ = true;
+
+    std::shared_ptr<MediaDeadlineExecutor> executor_;
+    size_t inflight_ = 0;
+    std::atomic<size_t> missCount_{0};
+
+    bool autoScale_ = false;
+    size_t minCount_ = 1;
+    size_t maxCount_ = 1;
+    size_t idleTimeoutMs_ = 1000;
+    size_t workers_ = 0;
+    size_t busy_ = 0;
+    int64_t processNs_ = 0;
+    boost::chrono::steady_clock::time_point lastScaleUp_;
+    std::vector<boost::thread::id> retired_;
 };
 
 
@@ -540,6 +1889,7 @@ class BaseMediaProcessCachePipe : public BaseMediaProcessPipe {
 public:
     explicit BaseMediaProcessCachePipe(const size_t lowLevel = 0, const size_t highLevel = SIZE_MAX) :
         BaseMediaProcessPipe(), lowLevel_(lowLevel), highLevel_(highLevel) {
+        asyncInput_ = true;
     }
 
     ~BaseMediaProcessCachePipe() {
@@ -560,18 +1910,36 @@ public:
     };
 
     virtual void input(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
-        boost::unique_lock<boost::mutex> lock(mutex_);
+        CacheEntry entry;
+        entry.deadline = mediaElement->getDeadline();
+        entry.me = mediaElement;
+
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
         while (running_) {
-            while (cache_.size() >= highLevel_) {
+            while (running_ && cache_.size() >= highLevel_) {
                 // block here
+                ++highLevelCount_;
                 if (dealHighLevel(mediaElement)) {
                     return;
                 }
+                MediaStageStats::Clock::time_point begin = MediaStageStats::Clock::now();
+                ++inputWaiters_;
                 enterLowCond_.wait(lock);
+                --inputWaiters_;
+                inputBlockedNs_ += MediaStageStats::since(begin);
+            }
+
+            if (MediaDeadlineExecutor::expired(entry.deadline)) {
+                // drop early
+                ++missCount_;
+                return;
             }
 
             if (running_ && (cache_.size() < highLevel_)) {
-                cache_.insert(mediaElement);
+                entry.seq = seq_++;
+                entry.inTime = MediaStageStats::Clock::now();
+                cache_.insert(entry);
+                depth_.set(cache_.size());
                 if (cache_.size() == 1) {
                     // first
                     firstCond_.notify_one();
@@ -581,21 +1949,47 @@ public:
         }
     }
 
+    // input blocks when cache reaches highLevel, till it drains to lowLevel. applied at once while
+    // running, blocked input rechecks the new levels.
+    void setLevels(const size_t lowLevel, const size_t highLevel) {
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        lowLevel_ = lowLevel;
+        highLevel_ = highLevel;
+        enterLowCond_.notify_all();
+    }
+
+    MediaQueueGauges getGauges() const {
+        MediaQueueGauges gauges;
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        depth_.readInto(gauges);
+        gauges.inputBlockedNs = inputBlockedNs_;
+        gauges.idleNs = idleNs_;
+        gauges.highLevelCount = highLevelCount_;
+        gauges.workers = running_ ? 1 : 0;
+        gauges.deadlineMisses = missCount_.load();
+        return gauges;
+    }
+
     virtual void start() {
         reset();
-        boost::unique_lock<boost::mutex> lock(mutex_);
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
         running_ = true;
+        depth_.reset();
+        inputBlockedNs_ = 0;
+        idleNs_ = 0;
+        highLevelCount_ = 0;
         boost::thread t(&BaseMediaProcessCachePipe::run_, this);
         proc_.swap(t);
     }
 
     virtual void stop(bool graceful = true) {
-        boost::unique_lock<boost::mutex> lock(mutex_);
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
         stopGraceful_ = graceful;
         running_ = false;
         enterLowCond_.notify_all();
         enterLowCond_.notify_all();
         firstCond_.notify_all();
+        drainCond_.notify_all();
     }
 
     virtual void wait() {
@@ -604,53 +1998,128 @@ public:
         }
     }
 
+    // wait till the cache is empty and its last element passed on, input is held by caller.
+    virtual bool drain(const MediaStageStats::Clock::time_point &deadline = MediaStageStats::Clock::time_point::max()) {
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
+        ++drainers_;
+        while (running_ && (!cache_.empty() || outputting_) && MediaStageStats::Clock::now() < deadline) {
+            drainCond_.wait_for(lock, drainWait_(deadline));
+        }
+        --drainers_;
+        return cache_.empty() && !outputting_;
+    }
+
+    virtual bool finish(const MediaStageStats::Clock::time_point &deadline) {
+        bool drained = drain(deadline);
+        stop(drained);
+        wait();
+        return drained;
+    }
+
+    virtual void abort() {
+        stop(false);
+    }
+
     virtual void reset() {
         stop(true);
         wait();
 
-        boost::unique_lock<boost::mutex> lock(mutex_);
+        boost::unique_lock<MediaBoostMutex> lock(mutex_);
         cache_.clear();
     }
 
+    // elements dropped for their deadline passed.
+    const size_t deadlineMissCount() const {
+        return missCount_.load();
+    }
+
 private:
+    // earliest deadline out first, then first in first out.
+    struct CacheEntry {
+        MediaDeadlineExecutor::Clock::time_point deadline;
+        uint64_t seq = 0;
+        std::shared_ptr<BaseMediaElement> me;
+        MediaStageStats::Clock::time_point inTime;
+
+        bool operator<(const CacheEntry &other) const {
+            if (deadline != other.deadline) {
+                return deadline < other.deadline;
+            }
+            return seq < other.seq;
+        }
+    };
+
+    virtual bool readGauges_(MediaQueueGauges &gauges) const {
+        gauges = getGauges();
+        return true;
+    }
+
     void run_() {
+        placement_.apply();
         while (running_) {
             std::shared_ptr<BaseMediaElement> me = nullptr;
 
             // pick out
             {
-                boost::unique_lock<boost::mutex> lock(mutex_);
+                boost::unique_lock<MediaBoostMutex> lock(mutex_);
                 if (cache_.size() > 0) {
-                    std::set<std::shared_ptr<BaseMediaElement> >::iterator x = cache_.begin();
-                    me = *x;
+                    std::set<CacheEntry>::iterator x = cache_.begin();
+                    if (MediaDeadlineExecutor::expired(x->deadline)) {
+                        ++missCount_;
+                    } else {
+                        me = x->me;
+                        outputting_ = true;
+                        if (MediaStageStats::enabled()) {
+                            stats_.recordWait(MediaStageStats::since(x->inTime));
+                        }
+                    }
 
                     cache_.erase(x);
-                    if (cache_.size() == lowLevel_) {
-                        enterLowCond_.notify_one();
+                    depth_.set(cache_.size());
+                    if (cache_.size() <= lowLevel_ && inputWaiters_ > 0) {
+                        // wake all, a single wake is lost if the cache drains below low level before it runs.
+                        enterLowCond_.notify_all();
                     }
                 }
                 else {
                     // wait new till 1 second.
+                    MediaStageStats::Clock::time_point begin = MediaStageStats::Clock::now();
                     firstCond_.wait_for(lock, boost::chrono::seconds(1));
+                    idleNs_ += MediaStageStats::since(begin);
                 }
             }
 
             if (me) {
+                MediaMemoryAccountScope account(me->account());
+                MediaStageStats::Clock::time_point begin = MediaStageStats::Clock::now();
                 if (outputHandlers_.find(0) != outputHandlers_.end()) {
                     outputHandlers_[0](me);
                 }
+                if (MediaTracer::instance().enabled()) {
+                    MediaTracer::instance().record(traceNameId_(), me->id(), begin, MediaStageStats::Clock::now());
+                }
+                outputting_.store(false);
+            }
+            if (drainers_.load() > 0) {
+                boost::unique_lock<MediaBoostMutex> lock(mutex_);
+                drainCond_.notify_all();
             }
         }
 
         if (stopGraceful_) {
-            // process remain data.
-            boost::unique_lock<boost::mutex> lock(mutex_);
+            // process remain data, out of the lock so input and gauges are not held by downstream.
+            std::set<CacheEntry> remain;
+            {
+                boost::unique_lock<MediaBoostMutex> lock(mutex_);
+                remain.swap(cache_);
+                depth_.set(0);
+                enterLowCond_.notify_all();
+            }
             if (outputHandlers_.find(0) != outputHandlers_.end()) {
-                for (auto me : cache_) {
-                    outputHandlers_[0](me);
+                for (auto &entry : remain) {
+                    outputHandlers_[0](entry.me);
                 }
             }
-            cache_.clear();
         }
 
         running_ = false;
@@ -658,16 +2127,30 @@ private:
 
 private:
     bool running_ = false;
-    boost::mutex mutex_;
-    boost::condition_variable enterLowCond_;
-    boost::condition_variable enterHighCond_;
-    boost::condition_variable firstCond_;
+    mutable MediaBoostMutex mutex_ MEDIA_LOCK_SITE("BaseMediaProcessCachePipe::mutex_");
+    MediaBoostCondition enterLowCond_;
+    MediaBoostCondition enterHighCond_;
+    MediaBoostCondition firstCond_;
+    MediaBoostCondition drainCond_;
     boost::thread proc_;
+    // an element picked is being passed on, drain waits for it.
+    std::atomic<bool> outputting_{false};
+    std::atomic<size_t> drainers_{0};
 
     size_t lowLevel_;
     size_t highLevel_;
-    std::set<std::shared_ptr<BaseMediaElement> > cache_;
+    std::set<CacheEntry> cache_;
+    uint64_t seq_ = 0;
+    size_t inputWaiters_ = 0;
+
+    // gauges, under mutex_.
+    MediaDepthGauge depth_;
+    uint64_t inputBlockedNs_ = 0;
+    uint64_t idleNs_ = 0;
+    uint64_t highLevelCount_ = 0;
+
+    std::atomic<size_t> missCount_{0};
     bool stopGraceful_ = true;
 };
 
-#endif // MEDIA_PROCESS_H_
\ No newline at end of file
+#endif // MEDIA_PROCESS_H_
\ No newline at end of file
@@ -0,0 +1,322 @@
+#ifndef MEDIA_READER_H_
+#define MEDIA_READER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "media_element.h"
+#include "media_process.h"
+#include "media_uring.h"
+
+// files read in chunks with depth reads in flight, emitted in order, one thread drives all files.
+// io_uring when kernel has it with IORING_OP_READ, else a pool of depth threads doing pread.
+// metadata: "path", "offset" of chunk in file, "length" of valid bytes, the last chunk of a file is short,
+// and so is its buffer.
+class MediaAsyncFileGenerator: public BaseMediaProcessGenerator {
+ public:
+    MediaAsyncFileGenerator(const std::vector<std::string> &paths, const size_t &chunkSize = 1 << 20,
+                            const size_t &depth = 32, const bool useUring = true):
+        chunkSize_(chunkSize), depth_(std::max<size_t>(depth, 1)), slots_(depth_),
+        pool_(std::make_shared<BaseMediaBufferPool>(chunkSize, depth_ * 2)) {
+        for (auto &path : paths) {
+            File file;
+            file.path = path;
+            files_.emplace_back(file);
+        }
+        if (useUring) {
+            ring_ = MediaUring::create(static_cast<unsigned>(depth_));
+            if (ring_ && !ring_->supports(IORING_OP_READ)) {
+                ring_.reset();
+            }
+        }
+        if (!ring_) {
+            for (size_t i = 0; i < depth_; ++i) {
+                threads_.emplace_back(&MediaAsyncFileGenerator::readLoop_, this);
+            }
+        }
+    }
+
+    ~MediaAsyncFileGenerator() {
+        // buffers must outlive reads in flight.
+        drain_();
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stopped_ = true;
+            cond_.notify_all();
+        }
+        for (auto &t : threads_) {
+            t.join();
+        }
+        for (auto &file : files_) {
+            if (file.fd >= 0) {
+                ::close(file.fd);
+            }
+        }
+    }
+
+    virtual const size_t getInputCount() const {
+        return 0;
+    }
+
+    virtual const size_t getOutputCount() const {
+        return 1;
+    }
+
+    // shared pool, e.g. from the task host, buffer size must be chunk size.
+    void setBufferPool(const std::shared_ptr<BaseMediaBufferPool> &pool) {
+        if (pool->bufferSize() != chunkSize_) {
+            throw std::runtime_error("pool buffer size is not chunk size.");
+        }
+        pool_ = pool;
+    }
+
+    const bool usingUring() const {
+        return ring_ != nullptr;
+    }
+
+    virtual bool generate() {
+        if (interrupted_) {
+            return false;
+        }
+        fill_();
+        if (emitSeq_ == submitSeq_) {
+            return false;
+        }
+
+        Slot &slot = slots_[emitSeq_ % depth_];
+        wait_(slot);
+        ++emitSeq_;
+
+        File &file = files_[slot.file];
+        ssize_t result = slot.result;
+        std::shared_ptr<BaseMediaBuffer> buffer;
+        buffer.swap(slot.buffer);
+        if (ring_ && (result == -EINVAL || result == -EOPNOTSUPP)) {
+            // read op refused though the probe has it, e.g. by the file system, read it here.
+            result = readAll_(file.fd, buffer->data(), slot.length, slot.offset);
+        }
+        if (result >= 0 && static_cast<size_t>(result) < slot.length) {
+            // short read, rare on regular files, finish it here.
+            result = readAll_(file.fd, buffer->data() + result, slot.length - result, slot.offset + result);
+            result = result < 0 ? result : static_cast<ssize_t>(slot.length);
+        }
+        if (result < 0) {
+            throw std::runtime_error("read failed " + file.path + ": " + ::strerror(static_cast<int>(-result)));
+        }
+        if (--file.pending == 0 && file.planned) {
+            ::close(file.fd);
+            file.fd = -1;
+        }
+
+        if (slot.length < buffer->size()) {
+            // pooled buffer goes back to the pool with the view.
+            buffer = std::make_shared<MediaBufferView>(buffer, slot.length);
+        }
+        auto me = std::make_shared<BaseMediaElement>();
+        me->setMediaBuffer("chunk", buffer);
+        me->setMetadata<std::string>("path", file.path);
+        me->setMetadata<size_t>("offset", slot.offset);
+        me->setMetadata<size_t>("length", slot.length);
+        outputHandlers_[0](me);
+        return true;
+    }
+
+    virtual void interrupt() {
+        interrupted_ = true;
+    }
+
+ private:
+    struct File {
+        std::string path;
+        int fd = -1;
+        size_t size = 0;
+        // next offset to plan.
+        size_t next = 0;
+        // all chunks planned.
+        bool planned = false;
+        // chunks planned but not emitted.
+        size_t pending = 0;
+    };
+
+    struct Slot {
+        size_t file = 0;
+        size_t offset = 0;
+        size_t length = 0;
+        std::shared_ptr<BaseMediaBuffer> buffer;
+        ssize_t result = 0;
+        bool done = false;
+    };
+
+    static ssize_t readAll_(const int fd, uint8_t *data, const size_t &length, const size_t &offset) {
+        size_t done = 0;
+        while (done < length) {
+            ssize_t n = ::pread(fd, data + done, length - done, offset + done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                return -errno;
+            }
+            if (n == 0) {
+                return -EIO;
+            }
+            done += n;
+        }
+        return static_cast<ssize_t>(done);
+    }
+
+    // next chunk to read, false when all files are planned.
+    bool plan_(Slot &slot) {
+        while (nextFile_ < files_.size()) {
+            File &file = files_[nextFile_];
+            if (file.fd < 0 && !file.planned) {
+                file.fd = ::open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+                struct stat st;
+                if (file.fd < 0 || ::fstat(file.fd, &st) < 0) {
+                    throw std::runtime_error("can not open " + file.path);
+                }
+                file.size = static_cast<size_t>(st.st_size);
+                ::posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            }
+            if (file.next >= file.size) {
+                file.planned = true;
+                if (!file.pending && file.fd >= 0) {
+                    ::close(file.fd);
+                    file.fd = -1;
+                }
+                ++nextFile_;
+                continue;
+            }
+            slot.file = nextFile_;
+            slot.offset = file.next;
+            slot.length = std::min(chunkSize_, file.size - file.next);
+            file.next += slot.length;
+            file.planned = file.next >= file.size;
+            ++file.pending;
+            if (file.planned) {
+                ++nextFile_;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // keep depth reads in flight.
+    void fill_() {
+        bool queued = false;
+        while (submitSeq_ - emitSeq_ < depth_) {
+            size_t index = submitSeq_ % depth_;
+            Slot &slot = slots_[index];
+            if (!plan_(slot)) {
+                break;
+            }
+            slot.buffer = pool_->acquire();
+            slot.done = false;
+            ++submitSeq_;
+
+            if (ring_) {
+                int fd = files_[slot.file].fd;
+                unsigned length = static_cast<unsigned>(slot.length);
+                if (!ring_->read(fd, slot.buffer->data(), length, slot.offset, index)) {
+                    // submission queue full, hand what is queued to the kernel to make room.
+                    if (!ring_->submit() || !ring_->read(fd, slot.buffer->data(), length, slot.offset, index)) {
+                        throw std::runtime_error("io_uring submission queue full.");
+                    }
+                }
+                queued = true;
+            } else {
+                std::unique_lock<std::mutex> lock(mutex_);
+                queue_.emplace_back(index);
+                cond_.notify_one();
+            }
+        }
+        if (queued && !ring_->submit()) {
+            throw std::runtime_error("io_uring submit failed.");
+        }
+    }
+
+    void wait_(Slot &slot) {
+        if (ring_) {
+            while (true) {
+                ring_->reap([this](const uint64_t &index, const int &result) {
+                    slots_[index].result = result;
+                    slots_[index].done = true;
+                });
+                if (slot.done) {
+                    return;
+                }
+                if (!ring_->submit(1)) {
+                    throw std::runtime_error("io_uring wait failed.");
+                }
+            }
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!slot.done) {
+            doneCond_.wait(lock);
+        }
+    }
+
+    void drain_() {
+        while (emitSeq_ != submitSeq_) {
+            wait_(slots_[emitSeq_ % depth_]);
+            slots_[emitSeq_ % depth_].buffer = nullptr;
+            ++emitSeq_;
+        }
+    }
+
+    void readLoop_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            while (queue_.empty() && !stopped_) {
+                cond_.wait(lock);
+            }
+            if (queue_.empty()) {
+                return;
+            }
+            Slot &slot = slots_[queue_.front()];
+            queue_.pop_front();
+            int fd = files_[slot.file].fd;
+            lock.unlock();
+            ssize_t result = readAll_(fd, slot.buffer->data(), slot.length, slot.offset);
+            lock.lock();
+            slot.result = result;
+            slot.done = true;
+            doneCond_.notify_all();
+        }
+    }
+
+    size_t chunkSize_;
+    size_t depth_;
+    std::vector<File> files_;
+    size_t nextFile_ = 0;
+
+    std::vector<Slot> slots_;
+    uint64_t submitSeq_ = 0;
+    uint64_t emitSeq_ = 0;
+    std::shared_ptr<BaseMediaBufferPool> pool_;
+    std::atomic<bool> interrupted_{false};
+
+    std::unique_ptr<MediaUring> ring_;
+
+    // fallback
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::condition_variable doneCond_;
+    std::deque<size_t> queue_;
+    bool stopped_ = false;
+};
+
+#endif  // MEDIA_READER_H_
@@ -0,0 +1,528 @@
+#ifndef MEDIA_RECORD_H_
+#define MEDIA_RECORD_H_
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "media_element.h"
+#include "media_mmap.h"
+#include "media_process.h"
+
+// element stream file, capture once and replay for benchmark or debug.
+//
+// file:   file header, records.
+// record: record header, table, padding, buffer data each padded, all 64 byte aligned,
+//         so buffers replayed from the mapping are aligned for simd.
+// table:  per metadata  u32 name size, u32 value size, name, value (as stored in element),
+//         per buffer    u32 name size, u32 0, u64 offset in record, u64 size, name.
+// index:  path.idx, index header, then offset and time of each record.
+
+enum {
+    kMediaRecordAlign = 64,
+};
+
+struct MediaRecordFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    // steady clock of writer start, in nanoseconds.
+    int64_t begin;
+    uint8_t padding[40];
+};
+
+struct MediaRecordHeader {
+    uint32_t magic;
+    uint32_t tableSize;
+    // whole record with padding.
+    uint64_t length;
+    // since writer start, in nanoseconds.
+    int64_t time;
+    uint64_t elementId;
+    uint32_t metadataCount;
+    uint32_t bufferCount;
+    uint8_t padding[24];
+};
+
+struct MediaRecordIndexHeader {
+    char magic[8];
+    uint64_t count;
+    uint8_t padding[48];
+};
+
+struct MediaRecordIndexEntry {
+    uint64_t offset;
+    int64_t time;
+};
+
+static_assert(sizeof(MediaRecordFileHeader) == kMediaRecordAlign, "record file header size");
+static_assert(sizeof(MediaRecordHeader) == kMediaRecordAlign, "record header size");
+static_assert(sizeof(MediaRecordIndexHeader) == kMediaRecordAlign, "record index header size");
+
+static const char kMediaRecordFileMagic[8] = {'M', 'P', 'R', 'E', 'C', 'O', 'R', 'D'};
+static const char kMediaRecordIndexMagic[8] = {'M', 'P', 'R', 'I', 'N', 'D', 'E', 'X'};
+static const uint32_t kMediaRecordMagic = 0x4552504d;
+// 2: deadline as time left at capture.
+static const uint32_t kMediaRecordVersion = 2;
+
+inline size_t mediaRecordAligned(const size_t &size) {
+    return (size + kMediaRecordAlign - 1) / kMediaRecordAlign * kMediaRecordAlign;
+}
+
+// sink writing elements to a record file, buffers are gathered by writev without copy,
+// so they are held till written and should not be modified by other branches meanwhile.
+class MediaRecordSink: public BaseMediaProcessCollapsar {
+ public:
+    // records are written when batch reaches batchBytes, or on flush and close.
+    explicit MediaRecordSink(const std::string &path, const size_t &batchBytes = 4 << 20):
+        path_(path), batchBytes_(batchBytes), begin_(std::chrono::steady_clock::now()) {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            throw std::runtime_error("can not create " + path);
+        }
+
+        MediaRecordFileHeader header;
+        ::memset(&header, 0, sizeof(header));
+        ::memcpy(header.magic, kMediaRecordFileMagic, sizeof(header.magic));
+        header.version = kMediaRecordVersion;
+        header.begin = std::chrono::duration_cast<std::chrono::nanoseconds>(begin_.time_since_epoch()).count();
+        Pending pending;
+        pending.table.assign(reinterpret_cast<const char *>(&header), sizeof(header));
+        pending_.emplace_back(std::move(pending));
+        offset_ = sizeof(header);
+    }
+
+    ~MediaRecordSink() {
+        try {
+            close();
+        } catch (const std::exception &e) {
+            std::cerr << "record close error: " << e.what() << std::endl;
+        }
+    }
+
+    virtual const size_t getInputCount() const {
+        return 1;
+    }
+
+    virtual const size_t getOutputCount() const {
+        return 0;
+    }
+
+    virtual void input(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
+        std::map<std::string, std::string> metadata = mediaElement->getRawMetadata();
+        std::map<std::string, std::shared_ptr<BaseMediaBuffer> > buffers = mediaElement->getMediaBuffers();
+        int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin_).count();
+
+        Pending pending;
+        std::string &table = pending.table;
+        table.resize(sizeof(MediaRecordHeader));
+        for (auto &it : metadata) {
+            append_(table, static_cast<uint32_t>(it.first.size()));
+            append_(table, static_cast<uint32_t>(it.second.size()));
+            table += it.first;
+            table += it.second;
+        }
+
+        // buffer data follows the table, so its size is summed first.
+        size_t tableEnd = table.size();
+        for (auto &it : buffers) {
+            tableEnd += sizeof(uint32_t) * 2 + sizeof(uint64_t) * 2 + it.first.size();
+        }
+        uint64_t dataOffset = mediaRecordAligned(tableEnd);
+        for (auto &it : buffers) {
+            uint64_t size = it.second ? it.second->size() : 0;
+            append_(table, static_cast<uint32_t>(it.first.size()));
+            append_(table, static_cast<uint32_t>(0));
+            append_(table, dataOffset);
+            append_(table, size);
+            table += it.first;
+            if (size) {
+                pending.buffers.emplace_back(it.second);
+            }
+            dataOffset += mediaRecordAligned(size);
+        }
+
+        MediaRecordHeader header;
+        ::memset(&header, 0, sizeof(header));
+        header.magic = kMediaRecordMagic;
+        header.tableSize = static_cast<uint32_t>(table.size() - sizeof(header));
+        header.length = dataOffset;
+        header.time = time;
+        header.elementId = mediaElement->id();
+        header.metadataCount = static_cast<uint32_t>(metadata.size());
+        header.bufferCount = static_cast<uint32_t>(buffers.size());
+        ::memcpy(&table[0], &header, sizeof(header));
+        table.resize(mediaRecordAligned(table.size()), '\0');
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (fd_ < 0) {
+            throw std::runtime_error("record sink closed.");
+        }
+        index_.push_back({offset_, time});
+        offset_ += header.length;
+        pendingBytes_ += header.length;
+        pending_.emplace_back(std::move(pending));
+        if (pendingBytes_ >= batchBytes_) {
+            flush_();
+        }
+    }
+
+    // write pending records, buffers of them are released after.
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (fd_ >= 0) {
+            flush_();
+        }
+    }
+
+    // end of stream from the graph, the file is closed. what is batched, at most batchBytes with a
+    // record over it, is written by one writev, so the deadline is not waited on. return false if
+    // writing or closing failed.
+    virtual bool finish(const MediaStageStats::Clock::time_point &deadline) {
+        try {
+            close();
+        } catch (const std::exception &e) {
+            if (!errorHandler_ || !errorHandler_(e)) {
+                std::cerr << "record close error: " << e.what() << std::endl;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    // flush and write index, elements after close are rejected.
+    void close() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (fd_ < 0) {
+            return;
+        }
+        flush_();
+        ::close(fd_);
+        fd_ = -1;
+        writeIndex_();
+    }
+
+    const size_t count() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return index_.size();
+    }
+
+ private:
+    struct Pending {
+        // file or record header with table and padding.
+        std::string table;
+        std::vector<std::shared_ptr<BaseMediaBuffer> > buffers;
+    };
+
+    template <typename T>
+    static void append_(std::string &out, const T &value) {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    static const uint8_t *zeros_() {
+        static const uint8_t zeros[kMediaRecordAlign] = {};
+        return zeros;
+    }
+
+    // writev in IOV_MAX chunks, partial writes resumed.
+    static void writeAll_(const int fd, std::vector<struct iovec> &iovs, const std::string &path) {
+        size_t i = 0;
+        while (i < iovs.size()) {
+            int count = static_cast<int>(std::min<size_t>(iovs.size() - i, IOV_MAX));
+            ssize_t n = ::writev(fd, &iovs[i], count);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("can not write " + path);
+            }
+            size_t left = static_cast<size_t>(n);
+            while (i < iovs.size() && left >= iovs[i].iov_len) {
+                left -= iovs[i].iov_len;
+                ++i;
+            }
+            if (left) {
+                iovs[i].iov_base = static_cast<uint8_t *>(iovs[i].iov_base) + left;
+                iovs[i].iov_len -= left;
+            }
+        }
+    }
+
+    void flush_() {
+        std::vector<struct iovec> iovs;
+        for (auto &pending : pending_) {
+            iovs.push_back({const_cast<char *>(pending.table.data()), pending.table.size()});
+            for (auto &buffer : pending.buffers) {
+                iovs.push_back({buffer->data(), buffer->size()});
+                size_t padding = mediaRecordAligned(buffer->size()) - buffer->size();
+                if (padding) {
+                    iovs.push_back({const_cast<uint8_t *>(zeros_()), padding});
+                }
+            }
+        }
+        writeAll_(fd_, iovs, path_);
+        pending_.clear();
+        pendingBytes_ = 0;
+    }
+
+    // written to a temporary file then renamed, a crashed capture has no index and is scanned on replay.
+    void writeIndex_() {
+        std::string path = path_ + ".idx";
+        std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("can not create " + tmp);
+        }
+        MediaRecordIndexHeader header;
+        ::memset(&header, 0, sizeof(header));
+        ::memcpy(header.magic, kMediaRecordIndexMagic, sizeof(header.magic));
+        header.count = index_.size();
+        std::vector<struct iovec> iovs;
+        iovs.push_back({&header, sizeof(header)});
+        if (!index_.empty()) {
+            iovs.push_back({index_.data(), index_.size() * sizeof(MediaRecordIndexEntry)});
+        }
+        try {
+            writeAll_(fd, iovs, tmp);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        if (::rename(tmp.c_str(), path.c_str()) < 0) {
+            throw std::runtime_error("can not rename " + tmp);
+        }
+    }
+
+    std::string path_;
+    size_t batchBytes_;
+    std::chrono::steady_clock::time_point begin_;
+
+    std::mutex mutex_;
+    int fd_ = -1;
+    uint64_t offset_ = 0;
+    size_t pendingBytes_ = 0;
+    std::vector<Pending> pending_;
+    std::vector<MediaRecordIndexEntry> index_;
+};
+
+enum MediaRecordPacing {
+    // as fast as downstream takes.
+    MediaRecordPacingFast = 1,
+    // at the intervals elements were captured.
+    MediaRecordPacingOriginal = 2,
+};
+
+// replay a record file from its mapping, buffers are views into it, metadata is restored as stored.
+class MediaRecordGenerator: public BaseMediaProcessGenerator {
+ public:
+    explicit MediaRecordGenerator(const std::string &path, const MediaRecordPacing &pacing = MediaRecordPacingFast):
+        pacing_(pacing), file_(MediaMappedFile::open(path)) {
+        const MediaRecordFileHeader *header = reinterpret_cast<const MediaRecordFileHeader *>(file_->data());
+        if (file_->size() < sizeof(MediaRecordFileHeader) ||
+            ::memcmp(header->magic, kMediaRecordFileMagic, sizeof(header->magic)) != 0 ||
+            header->version != kMediaRecordVersion) {
+            throw std::runtime_error("not a record file " + path);
+        }
+
+        if (!loadIndex_(path + ".idx")) {
+            scan_();
+        }
+        file_->advise(MADV_SEQUENTIAL);
+    }
+
+    virtual const size_t getInputCount() const {
+        return 0;
+    }
+
+    virtual const size_t getOutputCount() const {
+        return 1;
+    }
+
+    const size_t count() const {
+        return count_;
+    }
+
+    // capture time of record, since capture start, in nanoseconds.
+    const int64_t time(const size_t &index) const {
+        return index_[index].time;
+    }
+
+    // next generate replays record index, pacing restarts from it.
+    void seek(const size_t &index) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        next_ = std::min(index, count_);
+        paceStarted_ = false;
+        if (next_ < count_) {
+            file_->advise(MADV_WILLNEED, index_[next_].offset, recordLength_(next_));
+        }
+    }
+
+    virtual bool generate() {
+        size_t index;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (interrupted_ || next_ >= count_) {
+                return false;
+            }
+            index = next_++;
+
+            if (pacing_ == MediaRecordPacingOriginal) {
+                if (!paceStarted_) {
+                    paceStarted_ = true;
+                    paceStart_ = std::chrono::steady_clock::now();
+                    paceBase_ = index_[index].time;
+                }
+                std::chrono::steady_clock::time_point due =
+                    paceStart_ + std::chrono::nanoseconds(index_[index].time - paceBase_);
+                cond_.wait_until(lock, due, [this]() {
+                    return interrupted_;
+                });
+                if (interrupted_) {
+                    return false;
+                }
+            }
+        }
+
+        outputHandlers_[0](element_(index));
+        return true;
+    }
+
+    virtual void interrupt() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        interrupted_ = true;
+        cond_.notify_all();
+    }
+
+ private:
+    template <typename T>
+    static T read_(const uint8_t *&p, const uint8_t *end) {
+        if (static_cast<size_t>(end - p) < sizeof(T)) {
+            throw std::runtime_error("bad record table.");
+        }
+        T value;
+        ::memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+
+    static std::string readString_(const uint8_t *&p, const uint8_t *end, const size_t &size) {
+        if (static_cast<size_t>(end - p) < size) {
+            throw std::runtime_error("bad record table.");
+        }
+        std::string value(reinterpret_cast<const char *>(p), size);
+        p += size;
+        return value;
+    }
+
+    // index of a finished capture, mapped as well.
+    bool loadIndex_(const std::string &path) {
+        std::shared_ptr<MediaMappedFile> indexFile;
+        try {
+            indexFile = MediaMappedFile::open(path);
+        } catch (const std::exception &) {
+            return false;
+        }
+        if (indexFile->size() < sizeof(MediaRecordIndexHeader)) {
+            return false;
+        }
+        const MediaRecordIndexHeader *header = reinterpret_cast<const MediaRecordIndexHeader *>(indexFile->data());
+        if (::memcmp(header->magic, kMediaRecordIndexMagic, sizeof(header->magic)) != 0 ||
+            (indexFile->size() - sizeof(MediaRecordIndexHeader)) / sizeof(MediaRecordIndexEntry) < header->count) {
+            return false;
+        }
+        const MediaRecordIndexEntry *entries =
+            reinterpret_cast<const MediaRecordIndexEntry *>(indexFile->data() + sizeof(MediaRecordIndexHeader));
+        for (size_t i = 0; i < header->count; ++i) {
+            if (entries[i].offset + sizeof(MediaRecordHeader) > file_->size()) {
+                return false;
+            }
+        }
+        indexFile_ = indexFile;
+        index_ = entries;
+        count_ = header->count;
+        return true;
+    }
+
+    // no index, walk records by length, a torn tail record is ignored.
+    void scan_() {
+        uint64_t offset = sizeof(MediaRecordFileHeader);
+        while (offset + sizeof(MediaRecordHeader) <= file_->size()) {
+            const MediaRecordHeader *header = reinterpret_cast<const MediaRecordHeader *>(file_->data() + offset);
+            if (header->magic != kMediaRecordMagic || header->length < sizeof(MediaRecordHeader) ||
+                header->length > file_->size() - offset) {
+                break;
+            }
+            scanned_.push_back({offset, header->time});
+            offset += header->length;
+        }
+        index_ = scanned_.data();
+        count_ = scanned_.size();
+    }
+
+    const uint64_t recordLength_(const size_t &index) const {
+        return reinterpret_cast<const MediaRecordHeader *>(file_->data() + index_[index].offset)->length;
+    }
+
+    std::shared_ptr<BaseMediaElement> element_(const size_t &index) {
+        uint64_t offset = index_[index].offset;
+        const MediaRecordHeader *header = reinterpret_cast<const MediaRecordHeader *>(file_->data() + offset);
+        if (header->magic != kMediaRecordMagic || header->length > file_->size() - offset ||
+            sizeof(MediaRecordHeader) + header->tableSize > header->length) {
+            throw std::runtime_error("bad record at " + std::to_string(offset));
+        }
+
+        auto me = std::make_shared<BaseMediaElement>();
+        const uint8_t *p = file_->data() + offset + sizeof(MediaRecordHeader);
+        const uint8_t *end = p + header->tableSize;
+        for (uint32_t i = 0; i < header->metadataCount; ++i) {
+            uint32_t nameSize = read_<uint32_t>(p, end);
+            uint32_t valueSize = read_<uint32_t>(p, end);
+            std::string name = readString_(p, end, nameSize);
+            me->setRawMetadata(name, readString_(p, end, valueSize));
+        }
+        for (uint32_t i = 0; i < header->bufferCount; ++i) {
+            uint32_t nameSize = read_<uint32_t>(p, end);
+            read_<uint32_t>(p, end);
+            uint64_t dataOffset = read_<uint64_t>(p, end);
+            uint64_t size = read_<uint64_t>(p, end);
+            std::string name = readString_(p, end, nameSize);
+            if (dataOffset > header->length || size > header->length - dataOffset) {
+                throw std::runtime_error("bad record buffer at " + std::to_string(offset));
+            }
+            me->setMediaBuffer(name, std::make_shared<MediaMappedBuffer>(file_, offset + dataOffset, size));
+        }
+        return me;
+    }
+
+    MediaRecordPacing pacing_;
+    std::shared_ptr<MediaMappedFile> file_;
+    std::shared_ptr<MediaMappedFile> indexFile_;
+    std::vector<MediaRecordIndexEntry> scanned_;
+    const MediaRecordIndexEntry *index_ = nullptr;
+    size_t count_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    size_t next_ = 0;
+    bool interrupted_ = false;
+    bool paceStarted_ = false;
+    std::chrono::steady_clock::time_point paceStart_;
+    int64_t paceBase_ = 0;
+};
+
+#endif  // MEDIA_RECORD_H_
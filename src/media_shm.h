@@ -0,0 +1,630 @@
+#ifndef MEDIA_SHM_H_
+#define MEDIA_SHM_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "media_element.h"
+#include "media_process.h"
+
+// zero copy element transport between processes over a posix shared memory segment.
+//
+// segment: header, slot states, ring entries, then slot data, page aligned.
+// slot:    fixed size buffer storage, held by the producer while it fills it,
+//          and by the consumer once for each element referencing it, free when both let go.
+// entry:   one element, entry header then a table like the record format,
+//          per buffer    u32 name size, u32 slot, u64 size, name,
+//          per metadata  u32 name size, u32 value size, name, value (as stored in element).
+// one producer and one consumer process, waits are futexes on the segment. a consumer that dies
+// loses its slots when the next consumer attaches, or when the producer runs out of slots.
+
+struct MediaShmOptions {
+    size_t slotSize = 8 << 20;
+    size_t slotCount = 16;
+    // elements in flight, power of 2.
+    size_t ringSize = 64;
+    // metadata and buffer names of an element must fit.
+    size_t entrySize = 4096;
+};
+
+struct MediaShmHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entrySize;
+    uint64_t slotSize;
+    uint32_t slotCount;
+    uint32_t ringSize;
+    uint64_t slotsOffset;
+    uint64_t entriesOffset;
+    uint64_t dataOffset;
+    uint64_t totalSize;
+    // guards consumer attach against producer publishing.
+    uint32_t lock;
+    int32_t producerPid;
+    int32_t consumerPid;
+    uint32_t closed;
+    // consumer side, producer waits on progress when ring or slots are full.
+    alignas(64) uint32_t head;
+    uint32_t progress;
+    uint32_t producerWaiting;
+    // producer side, consumer waits on tail.
+    alignas(64) uint32_t tail;
+    uint32_t consumerWaiting;
+};
+
+struct MediaShmSlot {
+    uint32_t producer;
+    uint32_t consumer;
+    uint8_t padding[56];
+};
+
+struct MediaShmEntryHeader {
+    uint32_t metadataCount;
+    uint32_t bufferCount;
+    uint32_t tableSize;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(MediaShmSlot) == 64, "shm slot size");
+
+static const char kMediaShmMagic[8] = {'M', 'P', 'S', 'H', 'M', 'R', 'N', 'G'};
+static const uint32_t kMediaShmVersion = 1;
+
+// mapping of a segment, the creator unlinks its name when done.
+class MediaShmSegment {
+ public:
+    static std::shared_ptr<MediaShmSegment> create(const std::string &name, const MediaShmOptions &options) {
+        size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        if (!options.slotCount || !options.ringSize || (options.ringSize & (options.ringSize - 1)) ||
+            options.entrySize < sizeof(MediaShmEntryHeader) + 64) {
+            throw std::runtime_error("bad shm options.");
+        }
+        uint64_t slotSize = (options.slotSize + page - 1) / page * page;
+        uint64_t slotsOffset = (sizeof(MediaShmHeader) + 63) / 64 * 64;
+        uint64_t entrySize = (options.entrySize + 63) / 64 * 64;
+        uint64_t entriesOffset = slotsOffset + options.slotCount * sizeof(MediaShmSlot);
+        uint64_t dataOffset = (entriesOffset + options.ringSize * entrySize + page - 1) / page * page;
+        uint64_t totalSize = dataOffset + options.slotCount * slotSize;
+
+        // a segment left by a crashed producer is replaced.
+        ::shm_unlink(name.c_str());
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            throw std::runtime_error("can not create shm " + name + ": " + ::strerror(errno));
+        }
+        if (::ftruncate(fd, static_cast<off_t>(totalSize)) < 0) {
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+            throw std::runtime_error("can not size shm " + name);
+        }
+        std::shared_ptr<MediaShmSegment> segment(new MediaShmSegment(name, true));
+        segment->map_(fd, totalSize);
+
+        MediaShmHeader *header = segment->header();
+        ::memcpy(header->magic, kMediaShmMagic, sizeof(header->magic));
+        header->entrySize = static_cast<uint32_t>(entrySize);
+        header->slotSize = slotSize;
+        header->slotCount = static_cast<uint32_t>(options.slotCount);
+        header->ringSize = static_cast<uint32_t>(options.ringSize);
+        header->slotsOffset = slotsOffset;
+        header->entriesOffset = entriesOffset;
+        header->dataOffset = dataOffset;
+        header->totalSize = totalSize;
+        header->producerPid = ::getpid();
+        // version last, attach checks it.
+        __atomic_store_n(&header->version, kMediaShmVersion, __ATOMIC_RELEASE);
+        return segment;
+    }
+
+    static std::shared_ptr<MediaShmSegment> attach(const std::string &name) {
+        int fd = ::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(MediaShmHeader)) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            throw std::runtime_error("can not open shm " + name);
+        }
+        std::shared_ptr<MediaShmSegment> segment(new MediaShmSegment(name, false));
+        segment->map_(fd, static_cast<size_t>(st.st_size));
+        MediaShmHeader *header = segment->header();
+        if (::memcmp(header->magic, kMediaShmMagic, sizeof(header->magic)) != 0 ||
+            __atomic_load_n(&header->version, __ATOMIC_ACQUIRE) != kMediaShmVersion ||
+            header->totalSize != static_cast<uint64_t>(st.st_size)) {
+            throw std::runtime_error("not a media shm " + name);
+        }
+        return segment;
+    }
+
+    ~MediaShmSegment() {
+        if (base_) {
+            ::munmap(base_, size_);
+        }
+        if (creator_) {
+            ::shm_unlink(name_.c_str());
+        }
+    }
+
+    MediaShmSegment(const MediaShmSegment &) = delete;
+    MediaShmSegment &operator=(const MediaShmSegment &) = delete;
+
+    const std::string &name() const {
+        return name_;
+    }
+
+    MediaShmHeader *header() const {
+        return reinterpret_cast<MediaShmHeader *>(base_);
+    }
+
+    MediaShmSlot &slot(const size_t &index) const {
+        return reinterpret_cast<MediaShmSlot *>(base_ + header()->slotsOffset)[index];
+    }
+
+    uint8_t *slotData(const size_t &index) const {
+        return base_ + header()->dataOffset + index * header()->slotSize;
+    }
+
+    uint8_t *entry(const uint32_t &seq) const {
+        return base_ + header()->entriesOffset + (seq & (header()->ringSize - 1)) * header()->entrySize;
+    }
+
+    void lock() const {
+        while (__atomic_exchange_n(&header()->lock, 1, __ATOMIC_ACQUIRE)) {
+            ::sched_yield();
+        }
+    }
+
+    void unlock() const {
+        __atomic_store_n(&header()->lock, 0, __ATOMIC_RELEASE);
+    }
+
+    // consumer references are recounted from entries not consumed yet, those of a dead consumer dropped.
+    // lock held.
+    void recountConsumer() const {
+        MediaShmHeader *h = header();
+        std::vector<uint32_t> counts(h->slotCount, 0);
+        uint32_t tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+        for (uint32_t seq = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE); seq != tail; ++seq) {
+            const uint8_t *p = entry(seq);
+            const MediaShmEntryHeader *eh = reinterpret_cast<const MediaShmEntryHeader *>(p);
+            p += sizeof(MediaShmEntryHeader);
+            for (uint32_t i = 0; i < eh->bufferCount; ++i) {
+                uint32_t nameSize;
+                uint32_t slot;
+                ::memcpy(&nameSize, p, sizeof(nameSize));
+                ::memcpy(&slot, p + sizeof(nameSize), sizeof(slot));
+                p += 2 * sizeof(uint32_t) + sizeof(uint64_t) + nameSize;
+                if (slot < h->slotCount) {
+                    ++counts[slot];
+                }
+            }
+        }
+        for (uint32_t i = 0; i < h->slotCount; ++i) {
+            __atomic_store_n(&slot(i).consumer, counts[i], __ATOMIC_RELEASE);
+        }
+        wake(&h->progress);
+    }
+
+    static bool alive(const int32_t &pid) {
+        return pid > 0 && (::kill(pid, 0) == 0 || errno != ESRCH);
+    }
+
+    // wait while *addr is value, at most ms.
+    static void wait(uint32_t *addr, const uint32_t &value, const int &ms) {
+        struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+        ::syscall(SYS_futex, addr, FUTEX_WAIT, value, &ts, nullptr, 0);
+    }
+
+    static void wake(uint32_t *addr) {
+        ::syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+ private:
+    MediaShmSegment(const std::string &name, const bool creator): name_(name), creator_(creator) {}
+
+    void map_(const int fd, const size_t &size) {
+        void *base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            throw std::runtime_error("can not mmap shm " + name_);
+        }
+        base_ = static_cast<uint8_t *>(base);
+        size_ = size;
+    }
+
+    std::string name_;
+    bool creator_;
+    uint8_t *base_ = nullptr;
+    size_t size_ = 0;
+};
+
+// buffer whose storage is a slot of the segment, its reference on the slot is dropped on release.
+class MediaShmBuffer: public BaseMediaBuffer {
+ public:
+    MediaShmBuffer(const std::shared_ptr<MediaShmSegment> &segment, const uint32_t &slot, const size_t &size,
+                   const bool consumer):
+        BaseMediaBuffer(segment->slotData(slot), size), segment_(segment), slot_(slot), consumer_(consumer) {}
+
+    ~MediaShmBuffer() {
+        MediaShmSlot &slot = segment_->slot(slot_);
+        __atomic_sub_fetch(consumer_ ? &slot.consumer : &slot.producer, 1, __ATOMIC_RELEASE);
+        MediaShmHeader *header = segment_->header();
+        __atomic_add_fetch(&header->progress, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&header->producerWaiting, __ATOMIC_SEQ_CST)) {
+            MediaShmSegment::wake(&header->progress);
+        }
+    }
+
+    const std::shared_ptr<MediaShmSegment> &segment() const {
+        return segment_;
+    }
+
+    const uint32_t slot() const {
+        return slot_;
+    }
+
+ private:
+    std::shared_ptr<MediaShmSegment> segment_;
+    uint32_t slot_;
+    bool consumer_;
+};
+
+// producer end, creates the segment. buffers from acquire are passed without copy,
+// other buffers are copied into a slot first.
+class MediaShmSink: public BaseMediaProcessCollapsar {
+ public:
+    explicit MediaShmSink(const std::string &name, const MediaShmOptions &options = MediaShmOptions()):
+        segment_(MediaShmSegment::create(name, options)) {}
+
+    ~MediaShmSink() {
+        close();
+    }
+
+    virtual const size_t getInputCount() const {
+        return 1;
+    }
+
+    virtual const size_t getOutputCount() const {
+        return 0;
+    }
+
+    // buffer in the segment for upstream stages to fill, blocks till a slot is free.
+    std::shared_ptr<BaseMediaBuffer> acquire(const size_t &size) {
+        MediaShmHeader *header = segment_->header();
+        if (size > header->slotSize) {
+            throw std::runtime_error("buffer larger than shm slot.");
+        }
+        while (true) {
+            uint32_t progress = __atomic_load_n(&header->progress, __ATOMIC_ACQUIRE);
+            for (uint32_t i = 0; i < header->slotCount; ++i) {
+                uint32_t index = (nextSlot_ + i) % header->slotCount;
+                MediaShmSlot &slot = segment_->slot(index);
+                if (!__atomic_load_n(&slot.producer, __ATOMIC_ACQUIRE) &&
+                    !__atomic_load_n(&slot.consumer, __ATOMIC_ACQUIRE)) {
+                    __atomic_store_n(&slot.producer, 1, __ATOMIC_RELEASE);
+                    nextSlot_ = index + 1;
+                    return std::make_shared<MediaShmBuffer>(segment_, index, size, false);
+                }
+            }
+            waitProgress_(progress);
+        }
+    }
+
+    virtual void input(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
+        MediaShmHeader *header = segment_->header();
+        std::map<std::string, std::shared_ptr<BaseMediaBuffer> > buffers = mediaElement->getMediaBuffers();
+        std::map<std::string, std::string> metadata = mediaElement->getRawMetadata();
+
+        // buffers held till published, so their slots are not reused meanwhile.
+        std::vector<std::shared_ptr<BaseMediaBuffer> > held;
+        std::string table;
+        for (auto &it : buffers) {
+            if (!it.second) {
+                continue;
+            }
+            auto shm = std::dynamic_pointer_cast<MediaShmBuffer>(it.second);
+            if (!shm || shm->segment() != segment_) {
+                std::shared_ptr<BaseMediaBuffer> copy = acquire(it.second->size());
+                ::memcpy(copy->data(), it.second->data(), it.second->size());
+                copied_ += it.second->size();
+                shm = std::static_pointer_cast<MediaShmBuffer>(copy);
+            }
+            held.emplace_back(shm);
+            append_(table, static_cast<uint32_t>(it.first.size()));
+            append_(table, shm->slot());
+            append_(table, static_cast<uint64_t>(shm->size()));
+            table += it.first;
+        }
+        for (auto &it : metadata) {
+            append_(table, static_cast<uint32_t>(it.first.size()));
+            append_(table, static_cast<uint32_t>(it.second.size()));
+            table += it.first;
+            table += it.second;
+        }
+        if (sizeof(MediaShmEntryHeader) + table.size() > header->entrySize) {
+            throw std::runtime_error("element does not fit shm entry, raise entrySize.");
+        }
+
+        // wait for a free entry.
+        uint32_t tail = header->tail;
+        while (true) {
+            uint32_t progress = __atomic_load_n(&header->progress, __ATOMIC_ACQUIRE);
+            if (tail - __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) < header->ringSize) {
+                break;
+            }
+            waitProgress_(progress);
+        }
+
+        MediaShmEntryHeader entry;
+        entry.metadataCount = static_cast<uint32_t>(metadata.size());
+        entry.bufferCount = static_cast<uint32_t>(held.size());
+        entry.tableSize = static_cast<uint32_t>(table.size());
+        entry.reserved = 0;
+        uint8_t *p = segment_->entry(tail);
+        ::memcpy(p, &entry, sizeof(entry));
+        ::memcpy(p + sizeof(entry), table.data(), table.size());
+
+        segment_->lock();
+        for (auto &buffer : held) {
+            __atomic_add_fetch(&segment_->slot(static_cast<MediaShmBuffer *>(buffer.get())->slot()).consumer, 1,
+                               __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&header->tail, tail + 1, __ATOMIC_SEQ_CST);
+        segment_->unlock();
+        if (__atomic_load_n(&header->consumerWaiting, __ATOMIC_SEQ_CST)) {
+            MediaShmSegment::wake(&header->tail);
+        }
+        ++sent_;
+    }
+
+    // end of stream from the graph, elements sent are all in the segment already, nothing to wait on.
+    virtual bool finish(const MediaStageStats::Clock::time_point &deadline) {
+        close();
+        return true;
+    }
+
+    // consumer ends its stream after elements sent so far.
+    void close() {
+        MediaShmHeader *header = segment_->header();
+        __atomic_store_n(&header->closed, 1, __ATOMIC_SEQ_CST);
+        MediaShmSegment::wake(&header->tail);
+    }
+
+    virtual void interrupt() {
+        interrupted_ = true;
+    }
+
+    const std::shared_ptr<MediaShmSegment> &segment() const {
+        return segment_;
+    }
+
+    const uint64_t sent() const {
+        return sent_;
+    }
+
+    // bytes of buffers that were not from acquire.
+    const uint64_t bytesCopied() const {
+        return copied_;
+    }
+
+ private:
+    template <typename T>
+    static void append_(std::string &table, const T &value) {
+        table.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    // consumer released something or moved on, or it died and its slots are taken back.
+    void waitProgress_(const uint32_t &progress) {
+        if (interrupted_) {
+            throw std::runtime_error("shm sink interrupted.");
+        }
+        MediaShmHeader *header = segment_->header();
+        int32_t consumer = __atomic_load_n(&header->consumerPid, __ATOMIC_ACQUIRE);
+        if (consumer && !MediaShmSegment::alive(consumer)) {
+            segment_->lock();
+            if (__atomic_load_n(&header->consumerPid, __ATOMIC_ACQUIRE) == consumer) {
+                segment_->recountConsumer();
+                __atomic_store_n(&header->consumerPid, 0, __ATOMIC_RELEASE);
+            }
+            segment_->unlock();
+            return;
+        }
+        __atomic_store_n(&header->producerWaiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&header->progress, __ATOMIC_SEQ_CST) == progress) {
+            MediaShmSegment::wait(&header->progress, progress, 100);
+        }
+        __atomic_store_n(&header->producerWaiting, 0, __ATOMIC_SEQ_CST);
+    }
+
+    std::shared_ptr<MediaShmSegment> segment_;
+    uint32_t nextSlot_ = 0;
+    uint64_t sent_ = 0;
+    uint64_t copied_ = 0;
+    std::atomic<bool> interrupted_{false};
+};
+
+// consumer end, attaches to the segment of a sink by name. buffers of elements are the slots,
+// so they are shared with the producer and released back to it when the element is done.
+// stream ends when the sink is closed or its process died, after elements already sent.
+// one generator of a segment at a time in a process. the process stays its consumer while buffers
+// of an earlier generator are alive, a later generator then goes on with their references as they are.
+class MediaShmGenerator: public BaseMediaProcessGenerator {
+ public:
+    explicit MediaShmGenerator(const std::string &name): name_(name), segment_(attach_(name)) {}
+
+    ~MediaShmGenerator() {
+        std::unique_lock<std::mutex> lock(attachMutex_());
+        attached_()[name_].generator = false;
+    }
+
+    virtual const size_t getInputCount() const {
+        return 0;
+    }
+
+    virtual const size_t getOutputCount() const {
+        return 1;
+    }
+
+    virtual bool generate() {
+        MediaShmHeader *header = segment_->header();
+        uint32_t head = header->head;
+        while (true) {
+            uint32_t tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+            if (tail != head) {
+                break;
+            }
+            if (interrupted_ || __atomic_load_n(&header->closed, __ATOMIC_ACQUIRE) ||
+                !MediaShmSegment::alive(header->producerPid)) {
+                return false;
+            }
+            __atomic_store_n(&header->consumerWaiting, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&header->tail, __ATOMIC_SEQ_CST) == tail) {
+                MediaShmSegment::wait(&header->tail, tail, 100);
+            }
+            __atomic_store_n(&header->consumerWaiting, 0, __ATOMIC_SEQ_CST);
+        }
+
+        auto me = std::make_shared<BaseMediaElement>();
+        const uint8_t *p = segment_->entry(head);
+        MediaShmEntryHeader entry;
+        ::memcpy(&entry, p, sizeof(entry));
+        if (entry.tableSize > header->entrySize - sizeof(entry)) {
+            throw std::runtime_error("bad shm entry.");
+        }
+        p += sizeof(entry);
+        const uint8_t *end = p + entry.tableSize;
+        for (uint32_t i = 0; i < entry.bufferCount; ++i) {
+            uint32_t nameSize = read_<uint32_t>(p, end);
+            uint32_t slot = read_<uint32_t>(p, end);
+            uint64_t size = read_<uint64_t>(p, end);
+            std::string name = readString_(p, end, nameSize);
+            if (slot >= header->slotCount || size > header->slotSize) {
+                throw std::runtime_error("bad shm entry buffer.");
+            }
+            // the reference was taken by the producer when it published.
+            me->setMediaBuffer(name, std::make_shared<MediaShmBuffer>(segment_, slot, size, true));
+        }
+        for (uint32_t i = 0; i < entry.metadataCount; ++i) {
+            uint32_t nameSize = read_<uint32_t>(p, end);
+            uint32_t valueSize = read_<uint32_t>(p, end);
+            std::string name = readString_(p, end, nameSize);
+            me->setRawMetadata(name, readString_(p, end, valueSize));
+        }
+
+        __atomic_store_n(&header->head, head + 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&header->progress, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&header->producerWaiting, __ATOMIC_SEQ_CST)) {
+            MediaShmSegment::wake(&header->progress);
+        }
+        outputHandlers_[0](me);
+        return true;
+    }
+
+    virtual void interrupt() {
+        interrupted_ = true;
+        MediaShmSegment::wake(&segment_->header()->tail);
+    }
+
+ private:
+    template <typename T>
+    static T read_(const uint8_t *&p, const uint8_t *end) {
+        if (end - p < static_cast<ptrdiff_t>(sizeof(T))) {
+            throw std::runtime_error("bad shm entry table.");
+        }
+        T value;
+        ::memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+        return value;
+    }
+
+    static std::string readString_(const uint8_t *&p, const uint8_t *end, const size_t &size) {
+        if (static_cast<size_t>(end - p) < size) {
+            throw std::runtime_error("bad shm entry table.");
+        }
+        std::string value(reinterpret_cast<const char *>(p), size);
+        p += size;
+        return value;
+    }
+
+    struct Attached {
+        std::weak_ptr<MediaShmSegment> segment;
+        bool generator = false;
+    };
+
+    static std::mutex &attachMutex_() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    // segments this process consumes, by name.
+    static std::map<std::string, Attached> &attached_() {
+        static std::map<std::string, Attached> attached;
+        return attached;
+    }
+
+    static std::shared_ptr<MediaShmSegment> attach_(const std::string &name) {
+        std::unique_lock<std::mutex> lock(attachMutex_());
+        std::map<std::string, Attached> &attached = attached_();
+        for (auto it = attached.begin(); it != attached.end();) {
+            it = it->second.segment.expired() ? attached.erase(it) : std::next(it);
+        }
+        Attached &a = attached[name];
+        std::shared_ptr<MediaShmSegment> segment = a.segment.lock();
+        if (segment) {
+            if (a.generator) {
+                throw std::runtime_error("shm " + name + " has a consumer already.");
+            }
+            a.generator = true;
+            return segment;
+        }
+
+        std::shared_ptr<MediaShmSegment> mapped = MediaShmSegment::attach(name);
+        MediaShmHeader *header = mapped->header();
+        int32_t pid = ::getpid();
+        mapped->lock();
+        int32_t consumer = __atomic_load_n(&header->consumerPid, __ATOMIC_ACQUIRE);
+        if (consumer && consumer != pid && MediaShmSegment::alive(consumer)) {
+            mapped->unlock();
+            attached.erase(name);
+            throw std::runtime_error("shm " + name + " has a consumer already.");
+        }
+        // references left by a consumer before us.
+        mapped->recountConsumer();
+        __atomic_store_n(&header->consumerPid, pid, __ATOMIC_RELEASE);
+        mapped->unlock();
+
+        // the process stops being the consumer once the generator and its buffers are all gone.
+        segment.reset(mapped.get(), [mapped, pid](MediaShmSegment *) {
+            int32_t expected = pid;
+            __atomic_compare_exchange_n(&mapped->header()->consumerPid, &expected, 0, false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE);
+        });
+        a.segment = segment;
+        a.generator = true;
+        return segment;
+    }
+
+    std::string name_;
+    std::shared_ptr<MediaShmSegment> segment_;
+    std::atomic<bool> interrupted_{false};
+};
+
+#endif  // MEDIA_SHM_H_
@@ -0,0 +1,488 @@
+#ifndef MEDIA_STATS_H_
+#define MEDIA_STATS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// log-linear buckets as hdr histogram, 3 bits precision (12.5%) for values from 16 to 2^64.
+class MediaHistogram {
+ public:
+    enum {
+        kSubBits = 3,
+        kExactCount = 16,
+        kBucketCount = kExactCount + (64 - 4) * (1 << kSubBits),
+    };
+
+    static size_t bucketOf(const uint64_t &value) {
+        if (value < kExactCount) {
+            return static_cast<size_t>(value);
+        }
+        size_t msb = 63 - __builtin_clzll(value);
+        size_t sub = (value >> (msb - kSubBits)) & ((1 << kSubBits) - 1);
+        return kExactCount + (msb - 4) * (1 << kSubBits) + sub;
+    }
+
+    // highest value of bucket.
+    static uint64_t valueOf(const size_t &bucket) {
+        if (bucket < kExactCount) {
+            return bucket;
+        }
+        size_t msb = (bucket - kExactCount) / (1 << kSubBits) + 4;
+        uint64_t sub = (bucket - kExactCount) % (1 << kSubBits);
+        uint64_t low = (uint64_t(1) << msb) | (sub << (msb - kSubBits));
+        return low + (uint64_t(1) << (msb - kSubBits)) - 1;
+    }
+
+    MediaHistogram() {
+        buckets_.fill(0);
+    }
+
+    void add(const size_t &bucket, const uint64_t &count) {
+        buckets_[bucket] += count;
+        count_ += count;
+    }
+
+    void record(const uint64_t &value) {
+        add(bucketOf(value), 1);
+        sum_ += value;
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const MediaHistogram &other) {
+        for (size_t i = 0; i < kBucketCount; ++i) {
+            buckets_[i] += other.buckets_[i];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    const uint64_t count() const {
+        return count_;
+    }
+
+    const uint64_t sum() const {
+        return sum_;
+    }
+
+    const uint64_t max() const {
+        return max_;
+    }
+
+    const double mean() const {
+        return count_ ? static_cast<double>(sum_) / count_ : 0;
+    }
+
+    const uint64_t bucket(const size_t &index) const {
+        return buckets_[index];
+    }
+
+    // p in [0, 100], value within bucket precision.
+    const uint64_t percentile(const double &p) const {
+        if (!count_) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(p / 100 * count_ + 0.5);
+        rank = std::max<uint64_t>(rank, 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBucketCount; ++i) {
+            seen += buckets_[i];
+            if (seen >= rank) {
+                return std::min(valueOf(i), max_);
+            }
+        }
+        return max_;
+    }
+
+ private:
+    friend class MediaAtomicHistogram;
+
+    std::array<uint64_t, kBucketCount> buckets_;
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+};
+
+// one writer thread, any reader thread, no lock.
+class MediaAtomicHistogram {
+ public:
+    MediaAtomicHistogram() {
+        for (auto &b : buckets_) {
+            b.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(const uint64_t &value) {
+        increase_(buckets_[MediaHistogram::bucketOf(value)], 1);
+        increase_(sum_, value);
+        if (value > max_.load(std::memory_order_relaxed)) {
+            max_.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    void readInto(MediaHistogram &histogram) const {
+        for (size_t i = 0; i < MediaHistogram::kBucketCount; ++i) {
+            uint64_t count = buckets_[i].load(std::memory_order_relaxed);
+            if (count) {
+                histogram.add(i, count);
+            }
+        }
+        histogram.sum_ += sum_.load(std::memory_order_relaxed);
+        histogram.max_ = std::max(histogram.max_, max_.load(std::memory_order_relaxed));
+    }
+
+ private:
+    // single writer, so no read-modify-write needed.
+    static void increase_(std::atomic<uint64_t> &v, const uint64_t &n) {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<uint64_t>, MediaHistogram::kBucketCount> buckets_;
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+// merged stats of a stage.
+struct MediaStageCounters {
+    uint64_t elements = 0;
+    uint64_t bytes = 0;
+    // self time in input/generate/process, time in stages called from it not counted, in nanoseconds.
+    MediaHistogram process;
+    // time in input/generate/process with the stages it called synchronously, in nanoseconds.
+    MediaHistogram inclusive;
+    // time element waited in stage queue, in nanoseconds.
+    MediaHistogram wait;
+
+    // made while the stage was running, heap counts need MEDIA_ALLOC_PROFILE.
+    uint64_t heapAllocs = 0;
+    uint64_t heapBytes = 0;
+    uint64_t bufferAllocs = 0;
+    uint64_t bufferBytes = 0;
+    uint64_t bufferCopiedBytes = 0;
+    uint64_t elementsCreated = 0;
+};
+
+// stats of a stage, each thread records in its own shard, merged on read.
+class MediaStageStats {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    MediaStageStats(): id_(nextId_()) {
+        std::unique_lock<std::mutex> lock(registryMutex_());
+        registry_()[id_] = this;
+    }
+
+    ~MediaStageStats() {
+        std::unique_lock<std::mutex> lock(registryMutex_());
+        registry_().erase(id_);
+    }
+
+    MediaStageStats(const MediaStageStats &) = delete;
+    MediaStageStats &operator=(const MediaStageStats &) = delete;
+
+    // global switch, record calls cost nothing when off. off by default as timing every hop costs about
+    // as much as a hop, mpserver turns it on when metrics are exported. on in MEDIA_ALLOC_PROFILE
+    // builds, which charge allocations through it.
+    static std::atomic<bool> &enabled() {
+#ifdef MEDIA_ALLOC_PROFILE
+        static std::atomic<bool> on{true};
+#else
+        static std::atomic<bool> on{false};
+#endif
+        return on;
+    }
+
+    static uint64_t since(const Clock::time_point &begin) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+    }
+
+    // stage running in current thread, allocations are charged to it.
+    static MediaStageStats *&current() {
+        static thread_local MediaStageStats *stats = nullptr;
+        return stats;
+    }
+
+    void recordElement(const uint64_t &bytes) {
+        Shard &shard = shard_();
+        increase_(shard.elements, 1);
+        increase_(shard.bytes, bytes);
+    }
+
+    void recordProcess(const uint64_t &ns) {
+        shard_().process.record(ns);
+    }
+
+    void recordInclusive(const uint64_t &ns) {
+        shard_().inclusive.record(ns);
+    }
+
+    void recordWait(const uint64_t &ns) {
+        shard_().wait.record(ns);
+    }
+
+    void recordHeapAlloc(const uint64_t &bytes) {
+        Shard &shard = shard_();
+        increase_(shard.heapAllocs, 1);
+        increase_(shard.heapBytes, bytes);
+    }
+
+    void recordBufferAlloc(const uint64_t &bytes) {
+        Shard &shard = shard_();
+        increase_(shard.bufferAllocs, 1);
+        increase_(shard.bufferBytes, bytes);
+    }
+
+    void recordBufferCopy(const uint64_t &bytes) {
+        increase_(shard_().bufferCopiedBytes, bytes);
+    }
+
+    void recordElementCreated() {
+        increase_(shard_().elementsCreated, 1);
+    }
+
+    MediaStageCounters read() const {
+        MediaStageCounters counters;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto &shard : shards_) {
+            counters.elements += shard->elements.load(std::memory_order_relaxed);
+            counters.bytes += shard->bytes.load(std::memory_order_relaxed);
+            shard->process.readInto(counters.process);
+            shard->inclusive.readInto(counters.inclusive);
+            shard->wait.readInto(counters.wait);
+            counters.heapAllocs += shard->heapAllocs.load(std::memory_order_relaxed);
+            counters.heapBytes += shard->heapBytes.load(std::memory_order_relaxed);
+            counters.bufferAllocs += shard->bufferAllocs.load(std::memory_order_relaxed);
+            counters.bufferBytes += shard->bufferBytes.load(std::memory_order_relaxed);
+            counters.bufferCopiedBytes += shard->bufferCopiedBytes.load(std::memory_order_relaxed);
+            counters.elementsCreated += shard->elementsCreated.load(std::memory_order_relaxed);
+        }
+        return counters;
+    }
+
+ private:
+    struct Shard {
+        std::atomic<uint64_t> elements{0};
+        std::atomic<uint64_t> bytes{0};
+        MediaAtomicHistogram process;
+        MediaAtomicHistogram inclusive;
+        MediaAtomicHistogram wait;
+        std::atomic<uint64_t> heapAllocs{0};
+        std::atomic<uint64_t> heapBytes{0};
+        std::atomic<uint64_t> bufferAllocs{0};
+        std::atomic<uint64_t> bufferBytes{0};
+        std::atomic<uint64_t> bufferCopiedBytes{0};
+        std::atomic<uint64_t> elementsCreated{0};
+    };
+
+    // shard has one writer.
+    static void increase_(std::atomic<uint64_t> &v, const uint64_t &n) {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static uint64_t nextId_() {
+        static std::atomic<uint64_t> id{0};
+        return ++id;
+    }
+
+    // stats alive by id, so an exiting thread gives its shards back only to stats still there.
+    static std::mutex &registryMutex_() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::unordered_map<uint64_t, MediaStageStats *> &registry_() {
+        static std::unordered_map<uint64_t, MediaStageStats *> registry;
+        return registry;
+    }
+
+    // shards of a thread by stats id. when the thread exits they are reused by the next thread
+    // recording in the same stats, keeping their counts, so worker churn does not grow memory.
+    struct ShardHolder {
+        std::unordered_map<uint64_t, Shard *> shards;
+
+        ~ShardHolder() {
+            std::unique_lock<std::mutex> lock(registryMutex_());
+            for (auto &it : shards) {
+                auto stats = registry_().find(it.first);
+                if (stats != registry_().end()) {
+                    stats->second->release_(it.second);
+                }
+            }
+        }
+    };
+
+    // ids are never reused, so a shard of a destroyed stats is never looked up again.
+    Shard &shard_() {
+        static thread_local uint64_t lastId = 0;
+        static thread_local Shard *last = nullptr;
+        if (lastId == id_) {
+            return *last;
+        }
+
+        static thread_local ShardHolder holder;
+        Shard *&shard = holder.shards[id_];
+        if (!shard) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!freeShards_.empty()) {
+                shard = freeShards_.back();
+                freeShards_.pop_back();
+            } else {
+                shards_.emplace_back(new Shard());
+                shard = shards_.back().get();
+            }
+        }
+        lastId = id_;
+        last = shard;
+        return *shard;
+    }
+
+    void release_(Shard *shard) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        freeShards_.emplace_back(shard);
+    }
+
+    uint64_t id_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Shard> > shards_;
+    std::vector<Shard *> freeShards_;
+};
+
+// charge allocations in this scope to stats, nested scope wins.
+class MediaStageScope {
+ public:
+    explicit MediaStageScope(MediaStageStats *stats): prev_(MediaStageStats::current()) {
+        MediaStageStats::current() = stats;
+    }
+
+    ~MediaStageScope() {
+        MediaStageStats::current() = prev_;
+    }
+
+ private:
+    MediaStageStats *prev_;
+};
+
+// times a stage call, self time excludes stages it calls synchronously on this thread, e.g. through
+// output handlers, which are timed on a thread local stack. charges allocations to stats as
+// MediaStageScope does, null stats records nothing and keeps the current charge.
+class MediaStageTimer {
+ public:
+    using Clock = MediaStageStats::Clock;
+
+    explicit MediaStageTimer(MediaStageStats *stats): stats_(stats), parent_(top_()),
+        prevStats_(MediaStageStats::current()), begin_(Clock::now()) {
+        top_() = this;
+        if (stats) {
+            MediaStageStats::current() = stats;
+        }
+    }
+
+    ~MediaStageTimer() {
+        stop();
+    }
+
+    MediaStageTimer(const MediaStageTimer &) = delete;
+    MediaStageTimer &operator=(const MediaStageTimer &) = delete;
+
+    // records self and inclusive time once, returns the end.
+    const Clock::time_point &stop() {
+        if (stopped_) {
+            return end_;
+        }
+        stopped_ = true;
+        end_ = Clock::now();
+        top_() = parent_;
+        MediaStageStats::current() = prevStats_;
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end_ - begin_).count();
+        if (parent_) {
+            parent_->nested_ += ns;
+        }
+        if (stats_) {
+            stats_->recordProcess(ns > nested_ ? ns - nested_ : 0);
+            stats_->recordInclusive(ns);
+        }
+        return end_;
+    }
+
+    const Clock::time_point &begin() const {
+        return begin_;
+    }
+
+ private:
+    static MediaStageTimer *&top_() {
+        static thread_local MediaStageTimer *top = nullptr;
+        return top;
+    }
+
+    MediaStageStats *stats_;
+    MediaStageTimer *parent_;
+    MediaStageStats *prevStats_;
+    Clock::time_point begin_;
+    Clock::time_point end_;
+    uint64_t nested_ = 0;
+    bool stopped_ = false;
+};
+
+// queue of a stage, read by getGauges.
+struct MediaQueueGauges {
+    size_t depth = 0;
+    size_t peakDepth = 0;
+    // time weighted since start.
+    double averageDepth = 0;
+    // producers blocked in input, in nanoseconds.
+    uint64_t inputBlockedNs = 0;
+    // workers waiting for input, in nanoseconds.
+    uint64_t idleNs = 0;
+    uint64_t highLevelCount = 0;
+    // worker threads, or elements in flight on a shared executor.
+    size_t workers = 0;
+    // elements dropped for their deadline passed.
+    uint64_t deadlineMisses = 0;
+};
+
+// depth of a queue with time weighted average, used under owner's lock.
+class MediaDepthGauge {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    void reset() {
+        depth_ = 0;
+        peak_ = 0;
+        area_ = 0;
+        start_ = last_ = Clock::now();
+    }
+
+    void set(const size_t &depth) {
+        Clock::time_point now = Clock::now();
+        area_ += static_cast<double>(depth_) *
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count();
+        last_ = now;
+        depth_ = depth;
+        peak_ = std::max(peak_, depth);
+    }
+
+    void readInto(MediaQueueGauges &gauges) const {
+        Clock::time_point now = Clock::now();
+        double total = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start_).count();
+        double area = area_ + static_cast<double>(depth_) *
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count();
+        gauges.depth = depth_;
+        gauges.peakDepth = peak_;
+        gauges.averageDepth = total > 0 ? area / total : depth_;
+    }
+
+ private:
+    size_t depth_ = 0;
+    size_t peak_ = 0;
+    double area_ = 0;
+    Clock::time_point start_ = Clock::now();
+    Clock::time_point last_ = start_;
+};
+
+#endif  // MEDIA_STATS_H_
@@ -0,0 +1,220 @@
+#ifndef MEDIA_TRACE_H_
+#define MEDIA_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+// records stage slices of elements in per thread rings, written as chrome trace event json,
+// which perfetto ui opens as well.
+class MediaTracer {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    static MediaTracer &instance() {
+        static MediaTracer tracer;
+        return tracer;
+    }
+
+    // capacity is events kept per thread, old events are overwritten.
+    void enable(const size_t capacity = 65536) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        capacity_ = capacity ? capacity : 1;
+        enabled_ = true;
+    }
+
+    void disable() {
+        enabled_ = false;
+    }
+
+    bool enabled() const {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // id of a slice name, call once per stage.
+    uint32_t intern(const std::string &name) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = nameIds_.find(name);
+        if (it != nameIds_.end()) {
+            return it->second;
+        }
+        uint32_t id = static_cast<uint32_t>(names_.size());
+        std::string escaped;
+        for (auto c : name) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        names_.emplace_back(escaped);
+        nameIds_[name] = id;
+        return id;
+    }
+
+    // element id 0 for slice not bound to an element, such as generate.
+    void record(const uint32_t &nameId, const uint64_t &elementId, const Clock::time_point &begin,
+                const Clock::time_point &end) {
+        Ring &ring = ring_();
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        Event &event = ring.events[head % ring.events.size()];
+        event.nameId = nameId;
+        event.tid = ring.tid;
+        event.elementId = elementId;
+        event.begin = std::chrono::duration_cast<std::chrono::nanoseconds>(begin.time_since_epoch()).count();
+        event.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+    // can be called while recording, events being overwritten during write are skipped.
+    bool write(const std::string &path) {
+        std::ofstream out(path.c_str());
+        if (!out) {
+            return false;
+        }
+
+        std::vector<std::shared_ptr<Ring> > rings;
+        // thread owning each ring, 0 if it exited.
+        std::vector<uint32_t> owners;
+        std::vector<std::string> names;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            rings = rings_;
+            for (auto &ring : rings) {
+                owners.emplace_back(ring->released ? 0 : ring->tid);
+            }
+            names = names_;
+        }
+
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        char buf[256];
+        for (size_t r = 0; r < rings.size(); ++r) {
+            const std::shared_ptr<Ring> &ring = rings[r];
+            size_t capacity = ring->events.size();
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t tail = head > capacity ? head - capacity : 0;
+            std::vector<Event> events;
+            for (uint64_t i = tail; i < head; ++i) {
+                events.emplace_back(ring->events[i % capacity]);
+            }
+            // drop what writer overwrote while copying, and the slot of newHead it may be filling, which
+            // is that of event newHead - capacity.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t newHead = ring->head.load(std::memory_order_relaxed);
+            size_t skip = newHead + 1 > capacity + tail ? static_cast<size_t>(newHead + 1 - capacity - tail) : 0;
+
+            // a reused ring holds events of threads that exited before its owner took it.
+            std::set<uint32_t> tids;
+            for (size_t i = skip; i < events.size(); ++i) {
+                tids.insert(events[i].tid);
+            }
+            if (owners[r]) {
+                tids.insert(owners[r]);
+            }
+            for (auto tid : tids) {
+                snprintf(buf, sizeof(buf),
+                         "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u%s\"}}",
+                         tid, tid, tid == owners[r] ? "" : " (ended)");
+                out << (first ? "" : ",\n") << buf;
+                first = false;
+            }
+
+            for (size_t i = skip; i < events.size(); ++i) {
+                const Event &e = events[i];
+                const std::string &name = e.nameId < names.size() ? names[e.nameId] : unknown_();
+                snprintf(buf, sizeof(buf), "{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,",
+                         e.tid, e.begin / 1000.0, e.duration / 1000.0);
+                out << (first ? "" : ",\n") << buf << "\"name\":\"" << name << "\"";
+                first = false;
+                if (e.elementId) {
+                    // flow arrows link the slices of one element across stages.
+                    out << ",\"bind_id\":" << e.elementId << ",\"flow_in\":true,\"flow_out\":true"
+                        << ",\"args\":{\"element\":" << e.elementId << "}";
+                }
+                out << "}";
+            }
+        }
+        out << "]}\n";
+        return out.good();
+    }
+
+ private:
+    struct Event {
+        uint32_t nameId;
+        // thread that recorded it, rings outlive threads.
+        uint32_t tid;
+        uint64_t elementId;
+        int64_t begin;
+        int64_t duration;
+    };
+
+    struct Ring {
+        // of the thread owning it now, under tracer lock.
+        uint32_t tid;
+        bool released = false;
+        std::vector<Event> events;
+        std::atomic<uint64_t> head{0};
+    };
+
+    MediaTracer() {}
+
+    static const std::string &unknown_() {
+        static std::string name("unknown");
+        return name;
+    }
+
+    // ring of an exited thread is reused by the next new thread, so worker churn does not grow memory.
+    // every thread gets its own tid, the events it left keep theirs.
+    struct RingHolder {
+        Ring *ring = nullptr;
+
+        ~RingHolder() {
+            if (ring) {
+                MediaTracer::instance().release_(ring);
+            }
+        }
+    };
+
+    Ring &ring_() {
+        static thread_local RingHolder holder;
+        if (!holder.ring) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!freeRings_.empty()) {
+                holder.ring = freeRings_.back();
+                freeRings_.pop_back();
+                holder.ring->released = false;
+            } else {
+                std::shared_ptr<Ring> r = std::make_shared<Ring>();
+                r->events.resize(capacity_);
+                rings_.emplace_back(r);
+                holder.ring = r.get();
+            }
+            holder.ring->tid = nextTid_++;
+        }
+        return *holder.ring;
+    }
+
+    void release_(Ring *ring) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ring->released = true;
+        freeRings_.emplace_back(ring);
+    }
+
+    std::atomic<bool> enabled_{false};
+    std::mutex mutex_;
+    size_t capacity_ = 65536;
+    uint32_t nextTid_ = 1;
+    std::vector<std::shared_ptr<Ring> > rings_;
+    std::vector<Ring *> freeRings_;
+    std::vector<std::string> names_;
+    std::map<std::string, uint32_t> nameIds_;
+};
+
+#endif  // MEDIA_TRACE_H_
@@ -0,0 +1,195 @@
+#ifndef MEDIA_URING_H_
+#define MEDIA_URING_H_
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// minimal io_uring on raw syscalls, no liburing needed. one thread submits and reaps.
+class MediaUring {
+ public:
+    // nullptr if kernel has no io_uring or it is not allowed, callers fall back to blocking io.
+    static std::unique_ptr<MediaUring> create(const unsigned &entries) {
+        struct io_uring_params params;
+        ::memset(&params, 0, sizeof(params));
+        int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) {
+            return nullptr;
+        }
+        std::unique_ptr<MediaUring> ring(new MediaUring());
+        ring->fd_ = fd;
+        if (!ring->map_(params)) {
+            return nullptr;
+        }
+        return ring;
+    }
+
+    ~MediaUring() {
+        if (sqes_) {
+            ::munmap(sqes_, sqesSize_);
+        }
+        if (cqRing_ && cqRing_ != sqRing_) {
+            ::munmap(cqRing_, cqRingSize_);
+        }
+        if (sqRing_) {
+            ::munmap(sqRing_, sqRingSize_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    MediaUring(const MediaUring &) = delete;
+    MediaUring &operator=(const MediaUring &) = delete;
+
+    // whether the kernel has the opcode, e.g. IORING_OP_READ came with 5.6 and fails with -EINVAL
+    // before. kernels without the probe (before 5.6) have only the first opcodes.
+    bool supports(const int op) const {
+        std::vector<uint8_t> data(sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op), 0);
+        struct io_uring_probe *probe = reinterpret_cast<struct io_uring_probe *>(data.data());
+        if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, 256) < 0) {
+            return op <= IORING_OP_POLL_REMOVE;
+        }
+        return op <= probe->last_op && op < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    // queue a request, false if submission queue is full.
+    bool read(const int fd, void *buffer, const unsigned &length, const uint64_t &offset, const uint64_t &userData) {
+        return queue_(IORING_OP_READ, fd, buffer, length, offset, 0, userData);
+    }
+
+    bool write(const int fd, const void *buffer, const unsigned &length, const uint64_t &offset,
+               const uint64_t &userData) {
+        return queue_(IORING_OP_WRITE, fd, const_cast<void *>(buffer), length, offset, 0, userData);
+    }
+
+    // fdatasync when dataOnly.
+    bool fsync(const int fd, const bool dataOnly, const uint64_t &userData) {
+        return queue_(IORING_OP_FSYNC, fd, nullptr, 0, 0, dataOnly ? IORING_FSYNC_DATASYNC : 0, userData);
+    }
+
+    // submit queued requests, wait till at least minComplete completions are ready.
+    bool submit(const unsigned &minComplete = 0) {
+        unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+        while (true) {
+            int n = static_cast<int>(::syscall(__NR_io_uring_enter, fd_, queued_, minComplete, flags, nullptr, 0));
+            if (n >= 0) {
+                queued_ -= std::min<unsigned>(queued_, static_cast<unsigned>(n));
+                return true;
+            }
+            if (errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+    // call handler with user data and result (bytes or -errno) of every ready completion, return count.
+    size_t reap(const std::function<void(const uint64_t &, const int &)> &handler) {
+        size_t count = 0;
+        unsigned head = *cqHead_;
+        while (head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe &cqe = cqes_[head & *cqMask_];
+            handler(cqe.user_data, cqe.res);
+            ++head;
+            ++count;
+            __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+        }
+        return count;
+    }
+
+ private:
+    MediaUring() {}
+
+    bool map_(const struct io_uring_params &params) {
+        sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+        }
+
+        sqRing_ = mmap_(sqRingSize_, IORING_OFF_SQ_RING);
+        if (!sqRing_) {
+            return false;
+        }
+        cqRing_ = single ? sqRing_ : mmap_(cqRingSize_, IORING_OFF_CQ_RING);
+        if (!cqRing_) {
+            return false;
+        }
+        sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = static_cast<struct io_uring_sqe *>(mmap_(sqesSize_, IORING_OFF_SQES));
+        if (!sqes_) {
+            return false;
+        }
+
+        uint8_t *sq = static_cast<uint8_t *>(sqRing_);
+        sqHead_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sqTail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqEntries_ = params.sq_entries;
+        sqArray_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+        uint8_t *cq = static_cast<uint8_t *>(cqRing_);
+        cqHead_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void *mmap_(const size_t &size, const off_t &offset) {
+        void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    bool queue_(const int op, const int fd, void *buffer, const unsigned &length, const uint64_t &offset,
+                const unsigned &flags, const uint64_t &userData) {
+        unsigned tail = *sqTail_;
+        if (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) {
+            return false;
+        }
+        unsigned index = tail & *sqMask_;
+        struct io_uring_sqe &sqe = sqes_[index];
+        ::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = static_cast<uint8_t>(op);
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = length;
+        sqe.off = offset;
+        sqe.fsync_flags = flags;
+        sqe.user_data = userData;
+        sqArray_[index] = index;
+        __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+        ++queued_;
+        return true;
+    }
+
+    int fd_ = -1;
+    unsigned queued_ = 0;
+
+    void *sqRing_ = nullptr;
+    size_t sqRingSize_ = 0;
+    unsigned *sqHead_ = nullptr;
+    unsigned *sqTail_ = nullptr;
+    unsigned *sqMask_ = nullptr;
+    unsigned *sqArray_ = nullptr;
+    unsigned sqEntries_ = 0;
+    struct io_uring_sqe *sqes_ = nullptr;
+    size_t sqesSize_ = 0;
+
+    void *cqRing_ = nullptr;
+    size_t cqRingSize_ = 0;
+    unsigned *cqHead_ = nullptr;
+    unsigned *cqTail_ = nullptr;
+    unsigned *cqMask_ = nullptr;
+    struct io_uring_cqe *cqes_ = nullptr;
+};
+
+#endif  // MEDIA_URING_H_
@@ -0,0 +1,376 @@
+#ifndef MEDIA_WRITER_H_
+#define MEDIA_WRITER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "media_element.h"
+#include "media_process.h"
+
+enum MediaFileSyncPolicy {
+    // page cache only, kernel writes back when it likes.
+    MediaFileSyncNone = 1,
+    // start write back of every batch written, so dirty pages do not pile up into a burst.
+    MediaFileSyncWriteback = 2,
+    // fdatasync every syncIntervalMs, durable up to the interval.
+    MediaFileSyncData = 3,
+};
+
+struct MediaFileSinkOptions {
+    // elements are coalesced till batch reaches this, then written by the writer thread.
+    size_t batchBytes = 4 << 20;
+    // input blocks when this many bytes wait for the writer, 0 for no limit.
+    size_t maxPendingBytes = 64 << 20;
+    // bypass page cache, buffers are copied into aligned blocks as O_DIRECT needs.
+    bool direct = false;
+    MediaFileSyncPolicy sync = MediaFileSyncWriteback;
+    size_t syncIntervalMs = 1000;
+    // buffer written of each element, all buffers by name if empty.
+    std::string bufferName;
+};
+
+// writes buffers of elements to a file, "length" metadata limits bytes written of a buffer.
+// input only queues, writes and syncs are done by a writer thread, so upstream does not wait for disk.
+class MediaFileSink: public BaseMediaProcessCollapsar {
+ public:
+    enum {
+        kDirectAlign = 4096,
+    };
+
+    explicit MediaFileSink(const std::string &path, const MediaFileSinkOptions &options = MediaFileSinkOptions()):
+        path_(path), options_(options) {
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        if (options_.direct) {
+            flags |= O_DIRECT;
+            options_.batchBytes = std::max<size_t>(options_.batchBytes / kDirectAlign * kDirectAlign, kDirectAlign);
+            // one batch and a partial block left from last one.
+            if (::posix_memalign(reinterpret_cast<void **>(&staging_), kDirectAlign,
+                                 options_.batchBytes + kDirectAlign) != 0) {
+                throw std::runtime_error("can not allocate direct io staging.");
+            }
+        }
+        fd_ = ::open(path.c_str(), flags, 0644);
+        if (fd_ < 0) {
+            ::free(staging_);
+            throw std::runtime_error("can not create " + path + ": " + ::strerror(errno));
+        }
+        running_ = true;
+        writer_ = std::thread(&MediaFileSink::writeLoop_, this);
+    }
+
+    ~MediaFileSink() {
+        try {
+            close();
+        } catch (const std::exception &e) {
+            std::cerr << "file sink close error: " << e.what() << std::endl;
+        }
+        ::free(staging_);
+    }
+
+    virtual const size_t getInputCount() const {
+        return 1;
+    }
+
+    virtual const size_t getOutputCount() const {
+        return 0;
+    }
+
+    virtual void input(const size_t &index, const std::shared_ptr<BaseMediaElement> &mediaElement) {
+        std::vector<std::shared_ptr<BaseMediaBuffer> > buffers;
+        if (options_.bufferName.empty()) {
+            for (auto &it : mediaElement->getMediaBuffers()) {
+                buffers.emplace_back(it.second);
+            }
+        } else {
+            buffers.emplace_back(mediaElement->getMediaBuffer(options_.bufferName));
+        }
+        size_t limit = mediaElement->hasMetadata("length") ? mediaElement->getMetadata<size_t>("length") : SIZE_MAX;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!running_) {
+            throw std::runtime_error("file sink closed.");
+        }
+        if (!error_.empty()) {
+            throw std::runtime_error(error_);
+        }
+        for (auto &buffer : buffers) {
+            size_t size = buffer ? std::min(buffer->size(), limit) : 0;
+            if (size) {
+                current_.chunks.push_back({buffer, size});
+                current_.bytes += size;
+            }
+        }
+        if (current_.bytes >= options_.batchBytes) {
+            pendingBytes_ += current_.bytes;
+            batches_.emplace_back(std::move(current_));
+            current_ = Batch();
+            cond_.notify_all();
+            while (options_.maxPendingBytes && pendingBytes_ > options_.maxPendingBytes && error_.empty()) {
+                doneCond_.wait(lock);
+            }
+        }
+    }
+
+    // queue what is coalesced and wait till it is written, with direct io the last partial block waits for close.
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        flush_(lock);
+    }
+
+    // end of stream from the graph, what is not written by the deadline is dropped, the batch being
+    // written completes. return false if some was dropped.
+    virtual bool finish(const MediaStageStats::Clock::time_point &deadline) {
+        bool drained = true;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (running_ && current_.bytes) {
+                pendingBytes_ += current_.bytes;
+                batches_.emplace_back(std::move(current_));
+                current_ = Batch();
+                cond_.notify_all();
+            }
+            while (running_ && pendingBytes_ && error_.empty() && MediaStageStats::Clock::now() < deadline) {
+                doneCond_.wait_for(lock, std::chrono::nanoseconds(drainWait_(deadline).count()));
+            }
+            if (running_ && !batches_.empty() && error_.empty() && MediaStageStats::Clock::now() >= deadline) {
+                for (auto &batch : batches_) {
+                    pendingBytes_ -= batch.bytes;
+                }
+                batches_.clear();
+                drained = false;
+            }
+        }
+        try {
+            close();
+        } catch (const std::exception &e) {
+            if (!errorHandler_ || !errorHandler_(e)) {
+                std::cerr << "file sink close error: " << e.what() << std::endl;
+            }
+            return false;
+        }
+        return drained;
+    }
+
+    // write everything, sync unless policy is none, elements after close are rejected.
+    void close() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        // writer drains all batches before it exits.
+        if (current_.bytes) {
+            pendingBytes_ += current_.bytes;
+            batches_.emplace_back(std::move(current_));
+            current_ = Batch();
+        }
+        running_ = false;
+        cond_.notify_all();
+        lock.unlock();
+        writer_.join();
+
+        std::string error = error_;
+        if (error.empty() && options_.direct && stagingBytes_) {
+            // last partial block, O_DIRECT off for it.
+            ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) & ~O_DIRECT);
+            if (!writeAll_(staging_, stagingBytes_)) {
+                error = "can not write " + path_;
+            }
+            stagingBytes_ = 0;
+        }
+        if (error.empty() && options_.sync != MediaFileSyncNone && ::fdatasync(fd_) < 0) {
+            error = "can not sync " + path_;
+        }
+        ::close(fd_);
+        fd_ = -1;
+        if (!error.empty()) {
+            throw std::runtime_error(error);
+        }
+    }
+
+    const uint64_t bytesWritten() const {
+        return written_.load();
+    }
+
+ private:
+    struct Chunk {
+        std::shared_ptr<BaseMediaBuffer> buffer;
+        size_t size;
+    };
+
+    struct Batch {
+        std::vector<Chunk> chunks;
+        size_t bytes = 0;
+    };
+
+    void flush_(std::unique_lock<std::mutex> &lock) {
+        if (current_.bytes) {
+            pendingBytes_ += current_.bytes;
+            batches_.emplace_back(std::move(current_));
+            current_ = Batch();
+            cond_.notify_all();
+        }
+        while (pendingBytes_ && error_.empty()) {
+            doneCond_.wait(lock);
+        }
+        if (!error_.empty()) {
+            throw std::runtime_error(error_);
+        }
+    }
+
+    // at offset_, partial writes resumed.
+    bool writeAll_(const uint8_t *data, const size_t &size) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = ::pwrite(fd_, data + done, size - done, offset_ + done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            done += n;
+        }
+        offset_ += size;
+        written_ += size;
+        return true;
+    }
+
+    // gather buffers without copy, IOV_MAX at a time.
+    bool writev_(const Batch &batch) {
+        std::vector<struct iovec> iovs;
+        for (auto &chunk : batch.chunks) {
+            iovs.push_back({chunk.buffer->data(), chunk.size});
+        }
+        size_t i = 0;
+        while (i < iovs.size()) {
+            int count = static_cast<int>(std::min<size_t>(iovs.size() - i, IOV_MAX));
+            ssize_t n = ::pwritev(fd_, &iovs[i], count, offset_);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            offset_ += n;
+            written_ += n;
+            size_t left = static_cast<size_t>(n);
+            while (i < iovs.size() && left >= iovs[i].iov_len) {
+                left -= iovs[i].iov_len;
+                ++i;
+            }
+            if (left) {
+                iovs[i].iov_base = static_cast<uint8_t *>(iovs[i].iov_base) + left;
+                iovs[i].iov_len -= left;
+            }
+        }
+        return true;
+    }
+
+    // copy into aligned staging, write whole blocks, keep the partial block for next batch.
+    bool writeDirect_(const Batch &batch) {
+        for (auto &chunk : batch.chunks) {
+            size_t copied = 0;
+            while (copied < chunk.size) {
+                size_t n = std::min(chunk.size - copied, options_.batchBytes + kDirectAlign - stagingBytes_);
+                ::memcpy(staging_ + stagingBytes_, chunk.buffer->data() + copied, n);
+                stagingBytes_ += n;
+                copied += n;
+                if (stagingBytes_ >= options_.batchBytes && !writeBlocks_()) {
+                    return false;
+                }
+            }
+        }
+        return stagingBytes_ < kDirectAlign || writeBlocks_();
+    }
+
+    bool writeBlocks_() {
+        size_t blocks = stagingBytes_ / kDirectAlign * kDirectAlign;
+        if (!writeAll_(staging_, blocks)) {
+            return false;
+        }
+        ::memmove(staging_, staging_ + blocks, stagingBytes_ - blocks);
+        stagingBytes_ -= blocks;
+        return true;
+    }
+
+    void sync_(const uint64_t &begin) {
+        if (options_.sync == MediaFileSyncWriteback && offset_ > begin) {
+            ::sync_file_range(fd_, begin, offset_ - begin, SYNC_FILE_RANGE_WRITE);
+        } else if (options_.sync == MediaFileSyncData) {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (now - lastSync_ >= std::chrono::milliseconds(options_.syncIntervalMs)) {
+                ::fdatasync(fd_);
+                lastSync_ = now;
+            }
+        }
+    }
+
+    void writeLoop_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            while (batches_.empty() && running_) {
+                cond_.wait(lock);
+            }
+            if (batches_.empty()) {
+                return;
+            }
+            Batch batch = std::move(batches_.front());
+            batches_.pop_front();
+            lock.unlock();
+
+            uint64_t begin = offset_;
+            bool ok = options_.direct ? writeDirect_(batch) : writev_(batch);
+            if (ok) {
+                sync_(begin);
+            }
+            // buffers released out of lock.
+            size_t bytes = batch.bytes;
+            batch = Batch();
+
+            lock.lock();
+            pendingBytes_ -= bytes;
+            if (!ok && error_.empty()) {
+                error_ = "can not write " + path_ + ": " + ::strerror(errno);
+            }
+            doneCond_.notify_all();
+        }
+    }
+
+    std::string path_;
+    MediaFileSinkOptions options_;
+    int fd_ = -1;
+    // writer thread only, till it is joined.
+    uint64_t offset_ = 0;
+    uint8_t *staging_ = nullptr;
+    size_t stagingBytes_ = 0;
+    std::chrono::steady_clock::time_point lastSync_ = std::chrono::steady_clock::now();
+    std::atomic<uint64_t> written_{0};
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::condition_variable doneCond_;
+    bool running_ = false;
+    Batch current_;
+    std::deque<Batch> batches_;
+    size_t pendingBytes_ = 0;
+    std::string error_;
+    std::thread writer_;
+};
+
+#endif  // MEDIA_WRITER_H_